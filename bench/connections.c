@@ -0,0 +1,170 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/proactor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Memory held by the proactor per idle connection, with a million fds each waiting for data that never comes
+// The fds are dups of one socket, so the kernel isn't holding a million sockets too, and every mode runs in
+// its own process so the resident sizes don't overlap
+
+static atomic_int s_done;
+
+static uint64_t now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static size_t resident_bytes()
+{
+	size_t pages = 0, resident = 0;
+	FILE* f = fopen("/proc/self/statm","r");
+	if (f)
+	{
+		if (fscanf(f,"%zu %zu",&pages,&resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+static void idle_fn(task_t task, void* param)
+{
+	abort();
+}
+
+static void done_fn(task_t task, void* param)
+{
+	atomic_store(&s_done,1);
+}
+
+// Commands are handled in order, so a zero timeout timer queued last runs once everything before it is armed
+static void wait_done(proactor_t pr)
+{
+	atomic_store(&s_done,0);
+	proactor_add_timer(pr,0,0,0,NULL,&done_fn,NULL,0);
+
+	struct timespec ts = { 0, 100000 };
+	while (!atomic_load(&s_done))
+		nanosleep(&ts,NULL);
+}
+
+enum Mode
+{
+	MODE_RECV,
+	MODE_TIMED,
+	MODE_PERSISTENT,
+	MODE_COUNT
+};
+
+static const char* s_mode_names[MODE_COUNT] = { "recv watcher", "timed watcher", "persistent watcher" };
+
+static void run(enum Mode mode, int* fds, unsigned int count)
+{
+	scheduler_t sc = scheduler_create(4);
+	proactor_t pr = proactor_create(NULL);
+	wait_done(pr);
+
+	// A typical param: the connection's state
+	void* conn = NULL;
+	size_t before = resident_bytes();
+	uint64_t start = now_ns();
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		switch (mode)
+		{
+		case MODE_RECV:
+			proactor_add_recv_watcher(pr,fds[i],NULL,&idle_fn,&conn,sizeof(conn));
+			break;
+
+		case MODE_TIMED:
+			proactor_add_timed_recv_watcher(pr,fds[i],3600000,1000,NULL,&idle_fn,&idle_fn,&conn,sizeof(conn));
+			break;
+
+		default:
+			proactor_add_persistent_recv_watcher(pr,fds[i],1,NULL,&idle_fn,&conn,sizeof(conn));
+			break;
+		}
+	}
+	wait_done(pr);
+	double secs = (now_ns() - start) / 1e9;
+	size_t after = resident_bytes();
+
+	printf("%-20s %12u %12.1f %14.0f %12.1f\n",s_mode_names[mode],count,(after - before) / 1048576.0,(double)(after - before) / count,count / secs);
+
+	for (unsigned int i = 0; i < count; ++i)
+		proactor_cancel_recv_watcher(pr,fds[i]);
+
+	proactor_destroy(pr);
+	scheduler_destroy(sc);
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int count = argc > 1 ? strtoul(argv[1],NULL,10) : 1000000;
+
+	// As many fds as we are allowed
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE,&rl) == 0)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE,&rl);
+		getrlimit(RLIMIT_NOFILE,&rl);
+		if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)count + 64)
+		{
+			printf("fd limit is %llu, only watching %llu\n",(unsigned long long)rl.rlim_cur,(unsigned long long)rl.rlim_cur - 64);
+			count = rl.rlim_cur - 64;
+		}
+	}
+
+	int pair[2];
+	if (socketpair(AF_UNIX,SOCK_STREAM,0,pair) != 0)
+		abort();
+
+	int* fds = malloc(count * sizeof(int));
+	if (!fds)
+		abort();
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		fds[i] = dup(pair[0]);
+		if (fds[i] == -1)
+		{
+			perror("dup");
+			return 1;
+		}
+	}
+
+	printf("%-20s %12s %12s %14s %12s\n","mode","connections","MB","bytes/conn","arms/s");
+	fflush(stdout);
+	for (int mode = 0; mode < MODE_COUNT; ++mode)
+	{
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			run(mode,fds,count);
+			fflush(stdout);
+			_exit(0);
+		}
+		if (pid == -1 || waitpid(pid,NULL,0) != pid)
+			abort();
+	}
+
+	for (unsigned int i = 0; i < count; ++i)
+		close(fds[i]);
+	close(pair[0]);
+	close(pair[1]);
+	free(fds);
+	return 0;
+}
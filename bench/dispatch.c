@@ -0,0 +1,131 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/proactor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+// Bursts of ready events: thousands of timers due at once, and thousands of sockets made readable together,
+// dispatched with a task_run() per event against proactor_set_batch_dispatch()
+
+static atomic_uint s_fired;
+static atomic_uint_fast64_t s_last_ns;
+
+static uint64_t now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void wait_count(unsigned int count)
+{
+	struct timespec ts = { 0, 50000 };
+	while (atomic_load(&s_fired) < count)
+		nanosleep(&ts,NULL);
+}
+
+static void timer_fn(task_t task, void* param)
+{
+	atomic_store_explicit(&s_last_ns,now_ns(),memory_order_relaxed);
+	atomic_fetch_add_explicit(&s_fired,1,memory_order_relaxed);
+}
+
+static void recv_fn(task_t task, void* param)
+{
+	char buf[16];
+	while (read(*(const int*)param,buf,sizeof(buf)) > 0)
+		;
+
+	atomic_fetch_add_explicit(&s_fired,1,memory_order_relaxed);
+}
+
+// From the deadline until the last of the timers has run
+static double timer_burst(proactor_t pr, unsigned int count, unsigned int rounds)
+{
+	uint64_t total = 0;
+	for (unsigned int r = 0; r < rounds; ++r)
+	{
+		atomic_store(&s_fired,0);
+		uint64_t deadline = now_ns() + 20000000;
+		for (unsigned int i = 0; i < count; ++i)
+			proactor_add_timer(pr,20,0,0,NULL,&timer_fn,NULL,0);
+
+		wait_count(count);
+		total += atomic_load(&s_last_ns) - deadline;
+	}
+	return total / 1e6 / rounds;
+}
+
+// Every socket written at once, each round waits for all of the callbacks
+static double socket_burst(proactor_t pr, int (*fds)[2], unsigned int count, unsigned int rounds)
+{
+	atomic_store(&s_fired,0);
+	uint64_t start = now_ns();
+	for (unsigned int r = 0; r < rounds; ++r)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			if (write(fds[i][1],"x",1) != 1)
+				abort();
+		}
+		wait_count((r + 1) * count);
+	}
+	return (double)count * rounds / ((now_ns() - start) / 1e9);
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int count = argc > 1 ? strtoul(argv[1],NULL,10) : 5000;
+	unsigned int rounds = argc > 2 ? strtoul(argv[2],NULL,10) : 20;
+
+	int (*fds)[2] = malloc(count * sizeof(*fds));
+	if (!fds)
+		abort();
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		if (socketpair(AF_UNIX,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0,fds[i]) != 0)
+		{
+			perror("socketpair, try raising ulimit -n");
+			return 1;
+		}
+	}
+
+	// The proactor loop occupies one worker for good, the callbacks need the others
+	scheduler_t sc = scheduler_create(4);
+	proactor_t pr = proactor_create(NULL);
+
+	for (unsigned int i = 0; i < count; ++i)
+		proactor_add_persistent_recv_watcher(pr,fds[i][0],1,NULL,&recv_fn,&fds[i][0],sizeof(int));
+
+	printf("%u events per burst, %u bursts\n",count,rounds);
+	printf("%-10s %18s %18s\n","dispatch","timer burst ms","socket events/s");
+	for (int batch = 0; batch < 2; ++batch)
+	{
+		proactor_set_batch_dispatch(pr,batch);
+
+		double timer_ms = timer_burst(pr,count,rounds);
+		double socket_rate = socket_burst(pr,fds,count,rounds);
+		printf("%-10s %18.2f %18.0f\n",batch ? "batched" : "per event",timer_ms,socket_rate);
+	}
+
+	for (unsigned int i = 0; i < count; ++i)
+		proactor_cancel_recv_watcher(pr,fds[i][0]);
+
+	proactor_destroy(pr);
+	scheduler_destroy(sc);
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		close(fds[i][0]);
+		close(fds[i][1]);
+	}
+	free(fds);
+	return 0;
+}
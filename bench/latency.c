@@ -0,0 +1,116 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/proactor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+
+// Wake-to-run latency: from a timestamp being written to a socket until the watcher's callback reads it, one
+// message at a time so each finds the proactor waiting, blocked in the kernel against busy polling
+
+static uint64_t* s_samples;
+static unsigned int s_count;
+static atomic_uint s_received;
+
+static uint64_t now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void recv_fn(task_t task, void* param)
+{
+	uint64_t sent;
+	while (read(*(const int*)param,&sent,sizeof(sent)) == sizeof(sent))
+	{
+		unsigned int i = atomic_load_explicit(&s_received,memory_order_relaxed);
+		if (i < s_count)
+			s_samples[i] = now_ns() - sent;
+		atomic_store_explicit(&s_received,i + 1,memory_order_release);
+	}
+}
+
+static int cmp_u64(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(double p)
+{
+	return s_samples[(size_t)(p * (s_count - 1))] / 1000.0;
+}
+
+static void run(const char* name, scheduler_t sc, int idle, uint32_t budget_us, unsigned int flags, int* fds, unsigned int gap_us)
+{
+	proactor_t pr = idle ? proactor_create_idle(sc) : proactor_create(NULL);
+	if (!pr)
+		abort();
+
+	proactor_set_busy_poll(pr,budget_us,flags);
+	proactor_add_persistent_recv_watcher(pr,fds[0],1,NULL,&recv_fn,&fds[0],sizeof(int));
+
+	// Let the watcher get armed
+	struct timespec ts = { 0, 10000000 };
+	nanosleep(&ts,NULL);
+
+	atomic_store(&s_received,0);
+	struct timespec gap = { 0, gap_us * 1000 };
+	for (unsigned int i = 0; i < s_count; ++i)
+	{
+		uint64_t sent = now_ns();
+		if (write(fds[1],&sent,sizeof(sent)) != sizeof(sent))
+			abort();
+
+		do
+			nanosleep(&gap,NULL);
+		while (atomic_load_explicit(&s_received,memory_order_acquire) <= i);
+	}
+
+	proactor_cancel_recv_watcher(pr,fds[0]);
+	proactor_destroy(pr);
+
+	qsort(s_samples,s_count,sizeof(uint64_t),&cmp_u64);
+	printf("%-22s %10.1f %10.1f %10.1f %10.1f\n",name,percentile(0.5),percentile(0.9),percentile(0.99),percentile(0.999));
+}
+
+int main(int argc, char* argv[])
+{
+	s_count = argc > 1 ? strtoul(argv[1],NULL,10) : 20000;
+	unsigned int gap_us = argc > 2 ? strtoul(argv[2],NULL,10) : 50;
+	uint32_t budget_us = argc > 3 ? strtoul(argv[3],NULL,10) : 1000;
+	if (s_count < 1)
+		s_count = 1;
+
+	s_samples = malloc(s_count * sizeof(uint64_t));
+	if (!s_samples)
+		abort();
+
+	int fds[2];
+	if (socketpair(AF_UNIX,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0,fds) != 0)
+		abort();
+
+	// Busy polling keeps a core spinning, so this wants at least two to itself
+	scheduler_t sc = scheduler_create(4);
+
+	printf("%u messages, %uus apart, %uus busy poll budget\n",s_count,gap_us,budget_us);
+	printf("%-22s %10s %10s %10s %10s\n","wake to run, us","p50","p90","p99","p99.9");
+	run("blocking",sc,0,0,0,fds,gap_us);
+	run("busy poll",sc,0,budget_us,0,fds,gap_us);
+	run("busy poll, inline",sc,0,budget_us,PROACTOR_BUSY_POLL_INLINE,fds,gap_us);
+	run("idle blocking",sc,1,0,0,fds,gap_us);
+	run("idle busy poll",sc,1,budget_us,0,fds,gap_us);
+
+	scheduler_destroy(sc);
+	close(fds[0]);
+	close(fds[1]);
+	free(s_samples);
+	return 0;
+}
@@ -0,0 +1,527 @@
+
+#define _GNU_SOURCE
+
+#include "../src/proactor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Request-response over loopback TCP or AF_UNIX, a server and a load generator each on a proactor of their own:
+// echo with every connection keeping one request in flight, the same with the server re-arming an idle timer per
+// request, and a storm of connections that each carry one request and close
+// Every run is a process of its own, and its CPU time covers both ends, the proactor loops and workers alike
+
+#define MSG_SIZE 32
+#define ACCEPTS 16            // Kept outstanding on the listening socket
+#define IDLE_TIMEOUT 30000    // Never reached, the timer is re-armed by every request
+#define IDLE_SLACK 100
+#define CONNECT_AHEAD 1000    // Connections not yet accepted, so the listen queue never overflows
+#define STORM_MAX 1000
+
+enum Scenario
+{
+	SCENARIO_ECHO,
+	SCENARIO_TIMERS,
+	SCENARIO_STORM,
+	SCENARIO_COUNT
+};
+
+static const char* s_scenario_names[SCENARIO_COUNT] = { "echo", "echo + timers", "storm" };
+
+struct Conn
+{
+	int          m_fd;
+	unsigned int m_got;    // Client, bytes of the response so far
+	unsigned int m_timer;  // Server, the idle timer
+	uint64_t     m_sent;
+};
+
+static enum Scenario s_scenario;
+static int s_unix;
+static proactor_t s_server;
+static proactor_t s_client;
+static int s_listen_fd;
+static struct sockaddr_storage s_addr;
+static socklen_t s_addr_len;
+static struct Conn* s_server_conns;  // By fd
+static size_t s_fd_limit;
+static struct Conn* s_client_conns;
+
+static atomic_int s_stop;
+static atomic_int s_done;
+static atomic_uint s_accepted;
+static atomic_uint_fast64_t s_requests;
+static atomic_uint_fast64_t s_errors;
+
+// Latency in ns, 16 buckets to each power of two
+#define SUB_BITS 4
+#define BUCKETS ((65 - SUB_BITS) << SUB_BITS)
+static atomic_uint_fast64_t s_latency[BUCKETS];
+
+static uint64_t now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static uint64_t cpu_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void wait_ns(uint64_t ns)
+{
+	struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+	nanosleep(&ts,NULL);
+}
+
+static size_t bucket(uint64_t v)
+{
+	unsigned int shift = 0;
+	while ((v >> shift) >= (2 << SUB_BITS))
+		++shift;
+	return ((size_t)shift << SUB_BITS) + (size_t)(v >> shift);
+}
+
+// The highest value in bucket b, in microseconds
+static double bucket_us(size_t b)
+{
+	if (b < (2 << SUB_BITS))
+		return b / 1000.0;
+
+	unsigned int shift = (unsigned int)(b >> SUB_BITS) - 1;
+	return ((((uint64_t)(b - ((size_t)shift << SUB_BITS)) + 1) << shift) - 1) / 1000.0;
+}
+
+static double percentile(const uint64_t* counts, uint64_t total, double p)
+{
+	double rank = p * total;
+	uint64_t seen = 0;
+	for (size_t b = 0; b < BUCKETS; ++b)
+	{
+		seen += counts[b];
+		if (seen && seen >= rank)
+			return bucket_us(b);
+	}
+	return 0;
+}
+
+static void record(uint64_t start)
+{
+	atomic_fetch_add_explicit(&s_latency[bucket(now_ns() - start)],1,memory_order_relaxed);
+	atomic_fetch_add_explicit(&s_requests,1,memory_order_relaxed);
+}
+
+static void count_error()
+{
+	atomic_fetch_add_explicit(&s_errors,1,memory_order_relaxed);
+}
+
+static void done_fn(task_t task, void* param)
+{
+	atomic_store(&s_done,1);
+}
+
+// Commands are handled in order, so a zero timeout timer queued last runs once everything before it is armed
+static void wait_done(proactor_t pr)
+{
+	atomic_store(&s_done,0);
+	proactor_add_timer(pr,0,0,0,NULL,&done_fn,NULL,0);
+	while (!atomic_load(&s_done))
+		wait_ns(100000);
+}
+
+static void no_delay(int fd)
+{
+	int one = 1;
+	if (!s_unix)
+		setsockopt(fd,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+}
+
+static void send_request(struct Conn* c)
+{
+	char msg[MSG_SIZE] = { 0 };
+	if (write(c->m_fd,msg,MSG_SIZE) != MSG_SIZE)
+		count_error();
+}
+
+static void idle_fn(task_t task, void* param)
+{
+	count_error();
+}
+
+// Edge-triggered, so it reads until there is nothing left
+static void server_recv_fn(task_t task, void* param)
+{
+	int fd = *(const int*)param;
+	char buf[4096];
+	ssize_t n;
+	while ((n = read(fd,buf,sizeof(buf))) > 0)
+	{
+		// Before the response goes, so the next request can't race it
+		if (s_scenario == SCENARIO_TIMERS)
+		{
+			struct Conn* c = &s_server_conns[fd];
+			proactor_cancel_timer(s_server,c->m_timer);
+			c->m_timer = proactor_add_timer(s_server,IDLE_TIMEOUT,0,IDLE_SLACK,NULL,&idle_fn,&fd,sizeof(fd));
+		}
+
+		if (write(fd,buf,n) != n)
+			count_error();
+	}
+}
+
+// One-shot, re-armed until the client closes
+static void server_once_fn(task_t task, void* param)
+{
+	int fd = *(const int*)param;
+	char buf[4096];
+	ssize_t n = read(fd,buf,sizeof(buf));
+	if (n > 0 || (n == -1 && errno == EAGAIN))
+	{
+		if (n > 0 && write(fd,buf,n) != n)
+			count_error();
+		proactor_add_recv_watcher(s_server,fd,NULL,&server_once_fn,&fd,sizeof(fd));
+	}
+	else
+		close(fd);
+}
+
+static void accept_fn(task_t task, void* param)
+{
+	struct proactor_completion* c = param;
+	if (c->m_result)
+		count_error();
+	else
+	{
+		int fd = c->m_socket;
+		if ((size_t)fd >= s_fd_limit)
+		{
+			count_error();
+			close(fd);
+			proactor_accept(s_server,s_listen_fd,NULL,&accept_fn,NULL,0);
+			return;
+		}
+
+		no_delay(fd);
+		if (s_scenario == SCENARIO_STORM)
+			proactor_add_recv_watcher(s_server,fd,NULL,&server_once_fn,&fd,sizeof(fd));
+		else
+		{
+			if (s_scenario == SCENARIO_TIMERS)
+				s_server_conns[fd].m_timer = proactor_add_timer(s_server,IDLE_TIMEOUT,0,IDLE_SLACK,NULL,&idle_fn,&fd,sizeof(fd));
+			proactor_add_persistent_recv_watcher(s_server,fd,1,NULL,&server_recv_fn,&fd,sizeof(fd));
+		}
+		atomic_fetch_add(&s_accepted,1);
+	}
+
+	proactor_accept(s_server,s_listen_fd,NULL,&accept_fn,NULL,0);
+}
+
+// Closed loop: the next request goes as soon as the response is in
+static void client_recv_fn(task_t task, void* param)
+{
+	struct Conn* c = *(struct Conn* const*)param;
+	char buf[MSG_SIZE];
+	ssize_t n;
+	while ((n = read(c->m_fd,buf,MSG_SIZE - c->m_got)) > 0)
+	{
+		c->m_got += n;
+		if (c->m_got < MSG_SIZE)
+			continue;
+
+		record(c->m_sent);
+		c->m_got = 0;
+		if (!atomic_load_explicit(&s_stop,memory_order_relaxed))
+		{
+			c->m_sent = now_ns();
+			send_request(c);
+		}
+	}
+}
+
+static void storm_recv_fn(task_t task, void* param);
+static void storm_connected_fn(task_t task, void* param);
+
+// Connect, one request, close, and again, timed from the connect
+static void storm_start(struct Conn* c)
+{
+	c->m_fd = socket(s_addr.ss_family,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+	if (c->m_fd == -1)
+	{
+		count_error();
+		return;
+	}
+
+	// A reset rather than TIME_WAIT, or the ephemeral ports soon run out
+	if (!s_unix)
+	{
+		struct linger l = { 1, 0 };
+		setsockopt(c->m_fd,SOL_SOCKET,SO_LINGER,&l,sizeof(l));
+	}
+	no_delay(c->m_fd);
+
+	c->m_got = 0;
+	c->m_sent = now_ns();
+	if (proactor_connect(s_client,c->m_fd,(const struct sockaddr*)&s_addr,s_addr_len,NULL,&storm_connected_fn,&c,sizeof(c)) != 0)
+		abort();
+}
+
+static void storm_next(struct Conn* c)
+{
+	close(c->m_fd);
+	if (!atomic_load_explicit(&s_stop,memory_order_relaxed))
+		storm_start(c);
+}
+
+static void storm_connected_fn(task_t task, void* param)
+{
+	struct Conn* c = *(struct Conn* const*)PROACTOR_COMPLETION_PARAM(param);
+	if (((struct proactor_completion*)param)->m_result)
+	{
+		count_error();
+		storm_next(c);
+		return;
+	}
+
+	send_request(c);
+	proactor_add_recv_watcher(s_client,c->m_fd,NULL,&storm_recv_fn,&c,sizeof(c));
+}
+
+static void storm_recv_fn(task_t task, void* param)
+{
+	struct Conn* c = *(struct Conn* const*)param;
+	char buf[MSG_SIZE];
+	ssize_t n;
+	while ((n = read(c->m_fd,buf,MSG_SIZE - c->m_got)) > 0)
+	{
+		c->m_got += n;
+		if (c->m_got == MSG_SIZE)
+		{
+			record(c->m_sent);
+			storm_next(c);
+			return;
+		}
+	}
+
+	if (n == -1 && errno == EAGAIN)
+		proactor_add_recv_watcher(s_client,c->m_fd,NULL,&storm_recv_fn,&c,sizeof(c));
+	else
+	{
+		count_error();
+		storm_next(c);
+	}
+}
+
+static void listen_socket()
+{
+	memset(&s_addr,0,sizeof(s_addr));
+	if (s_unix)
+	{
+		// An abstract name, so there's no file to clean up
+		struct sockaddr_un* addr = (struct sockaddr_un*)&s_addr;
+		addr->sun_family = AF_UNIX;
+		int len = snprintf(addr->sun_path + 1,sizeof(addr->sun_path) - 1,"workshare-loopback-%d",(int)getpid());
+		s_addr_len = offsetof(struct sockaddr_un,sun_path) + 1 + len;
+	}
+	else
+	{
+		struct sockaddr_in* addr = (struct sockaddr_in*)&s_addr;
+		addr->sin_family = AF_INET;
+		addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		s_addr_len = sizeof(struct sockaddr_in);
+	}
+
+	s_listen_fd = socket(s_addr.ss_family,SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,0);
+	if (s_listen_fd == -1 || bind(s_listen_fd,(struct sockaddr*)&s_addr,s_addr_len) != 0 || listen(s_listen_fd,SOMAXCONN) != 0)
+		abort();
+
+	if (!s_unix && getsockname(s_listen_fd,(struct sockaddr*)&s_addr,&s_addr_len) != 0)
+		abort();
+}
+
+// Blocking connects, paced so the accepts keep up
+// Over TCP each block of source addresses in 127/8 has its own ephemeral ports, so there can be more than 28k
+static int connect_clients(unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		int fd = socket(s_addr.ss_family,SOCK_STREAM | SOCK_CLOEXEC,0);
+		if (fd == -1)
+		{
+			perror("socket");
+			return -1;
+		}
+
+		if (!s_unix)
+		{
+			struct sockaddr_in src = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + i / 16384) };
+#if defined(IP_BIND_ADDRESS_NO_PORT)
+			int one = 1;
+			setsockopt(fd,IPPROTO_IP,IP_BIND_ADDRESS_NO_PORT,&one,sizeof(one));
+#endif
+			if (bind(fd,(struct sockaddr*)&src,sizeof(src)) != 0)
+			{
+				perror("bind");
+				return -1;
+			}
+		}
+
+		while (i >= atomic_load(&s_accepted) + CONNECT_AHEAD)
+			wait_ns(100000);
+
+		if (connect(fd,(struct sockaddr*)&s_addr,s_addr_len) != 0)
+		{
+			perror("connect");
+			return -1;
+		}
+
+		fcntl(fd,F_SETFL,fcntl(fd,F_GETFL) | O_NONBLOCK);
+		no_delay(fd);
+
+		struct Conn* c = &s_client_conns[i];
+		c->m_fd = fd;
+		c->m_got = 0;
+		proactor_add_persistent_recv_watcher(s_client,fd,1,NULL,&client_recv_fn,&c,sizeof(c));
+	}
+
+	while (atomic_load(&s_accepted) < count)
+		wait_ns(100000);
+
+	wait_done(s_server);
+	wait_done(s_client);
+	return 0;
+}
+
+// One line of the table, run in a process of its own, which takes everything with it when it exits
+static void run(unsigned int workers, unsigned int count, double secs)
+{
+	// The main thread only waits, and each proactor loop occupies a worker for good
+	scheduler_create(workers + 3);
+	s_server = proactor_create(NULL);
+	s_client = proactor_create(NULL);
+
+	s_server_conns = calloc(s_fd_limit,sizeof(struct Conn));
+	s_client_conns = calloc(count,sizeof(struct Conn));
+	if (!s_server_conns || !s_client_conns)
+		abort();
+
+	listen_socket();
+	for (unsigned int i = 0; i < ACCEPTS; ++i)
+		proactor_accept(s_server,s_listen_fd,NULL,&accept_fn,NULL,0);
+
+	if (s_scenario == SCENARIO_STORM)
+	{
+		for (unsigned int i = 0; i < count; ++i)
+			storm_start(&s_client_conns[i]);
+	}
+	else
+	{
+		if (connect_clients(count) != 0)
+			return;
+
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			s_client_conns[i].m_sent = now_ns();
+			send_request(&s_client_conns[i]);
+		}
+	}
+
+	// Warm up, then start counting afresh
+	wait_ns((uint64_t)(secs * 2e8));
+	for (size_t b = 0; b < BUCKETS; ++b)
+		atomic_store(&s_latency[b],0);
+	atomic_store(&s_requests,0);
+	atomic_store(&s_errors,0);
+
+	uint64_t start = now_ns();
+	uint64_t cpu_start = cpu_ns();
+	wait_ns((uint64_t)(secs * 1e9));
+	uint64_t requests = atomic_load(&s_requests);
+	double elapsed = (now_ns() - start) / 1e9;
+	double cpu = (cpu_ns() - cpu_start) / 1e3;
+	atomic_store(&s_stop,1);
+
+	uint64_t counts[BUCKETS];
+	for (size_t b = 0; b < BUCKETS; ++b)
+		counts[b] = atomic_load(&s_latency[b]);
+
+	printf("%-14s %8u %12u %12.0f %10.1f %10.1f %10.1f %12.2f %8llu\n",s_scenario_names[s_scenario],workers,count,requests / elapsed,
+		percentile(counts,requests,0.5),percentile(counts,requests,0.99),percentile(counts,requests,0.999),
+		requests ? cpu / requests : 0.0,(unsigned long long)atomic_load(&s_errors));
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int max_workers = argc > 1 ? strtoul(argv[1],NULL,10) : 4;
+	unsigned int max_count = argc > 2 ? strtoul(argv[2],NULL,10) : 100000;
+	double secs = argc > 3 ? atof(argv[3]) : 2.0;
+	s_unix = argc > 4 && strcmp(argv[4],"unix") == 0;
+	if (max_workers < 1)
+		max_workers = 1;
+	if (secs <= 0)
+		secs = 2.0;
+
+	// Both ends of every connection are ours, so two fds each
+	s_fd_limit = 2 * (size_t)max_count + 64;
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE,&rl) == 0)
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE,&rl);
+		getrlimit(RLIMIT_NOFILE,&rl);
+		if (rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur < (rlim_t)s_fd_limit)
+		{
+			s_fd_limit = rl.rlim_cur;
+			max_count = rl.rlim_cur > 64 ? (unsigned int)((rl.rlim_cur - 64) / 2) : 0;
+			printf("fd limit is %llu, only up to %u connections\n",(unsigned long long)rl.rlim_cur,max_count);
+		}
+	}
+
+	printf("%s, %.1fs a run, CPU is both ends together\n",s_unix ? "AF_UNIX" : "loopback TCP",secs);
+	printf("%-14s %8s %12s %12s %10s %10s %10s %12s %8s\n","scenario","workers","connections","requests/s","p50 us","p99 us","p99.9 us","cpu us/req","errors");
+	fflush(stdout);
+
+	for (int scenario = 0; scenario < SCENARIO_COUNT; ++scenario)
+	{
+		for (unsigned int workers = 1; ; workers = workers * 2 < max_workers ? workers * 2 : max_workers)
+		{
+			// A storm is many connections over time, only so many at once
+			unsigned int limit = scenario == SCENARIO_STORM && max_count > STORM_MAX ? STORM_MAX : max_count;
+			for (unsigned int count = limit < 100 ? limit : 100; count; count = count == limit ? 0 : (count * 10 < limit ? count * 10 : limit))
+			{
+				pid_t pid = fork();
+				if (pid == 0)
+				{
+					s_scenario = scenario;
+					run(workers,count,secs);
+					fflush(stdout);
+					_exit(0);
+				}
+				if (pid == -1 || waitpid(pid,NULL,0) != pid)
+					abort();
+			}
+
+			if (workers == max_workers)
+				break;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,116 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/pipeline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// read -> transform (parallel) -> write (serial, in order)
+// The transform stage dominates, so throughput should scale with the number of workers
+
+struct Record
+{
+	uint64_t m_seq;
+	uint64_t m_value;
+};
+
+struct Bench
+{
+	unsigned int   m_records;
+	unsigned int   m_work;
+	uint64_t       m_next_in;
+	uint64_t       m_next_out;
+	struct Record* m_pool;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void* input_stage(void* item, void* param)
+{
+	struct Bench* b = param;
+	if (b->m_next_in == b->m_records)
+		return NULL;
+
+	struct Record* r = &b->m_pool[b->m_next_in];
+	r->m_seq = b->m_next_in++;
+	r->m_value = r->m_seq;
+	return r;
+}
+
+static void* transform_stage(void* item, void* param)
+{
+	struct Bench* b = param;
+	struct Record* r = item;
+
+	uint64_t v = r->m_value | 1;
+	for (unsigned int i = 0; i < b->m_work; ++i)
+	{
+		v ^= v << 13;
+		v ^= v >> 7;
+		v ^= v << 17;
+	}
+	r->m_value = v;
+	return r;
+}
+
+static void* output_stage(void* item, void* param)
+{
+	struct Bench* b = param;
+	struct Record* r = item;
+
+	if (r->m_seq != b->m_next_out++)
+		abort();
+
+	return r;
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+	unsigned int tokens = argc > 2 ? atoi(argv[2]) : 64;
+
+	struct Bench b = { .m_records = argc > 3 ? atoi(argv[3]) : 200000, .m_work = argc > 4 ? atoi(argv[4]) : 4000 };
+	b.m_pool = malloc(b.m_records * sizeof(struct Record));
+	if (!b.m_pool)
+		abort();
+
+	task_pipeline_t pl = task_pipeline_create(tokens);
+	task_pipeline_add_stage(pl,TASK_PIPELINE_SERIAL_IN_ORDER,&input_stage,&b);
+	task_pipeline_add_stage(pl,TASK_PIPELINE_PARALLEL,&transform_stage,&b);
+	task_pipeline_add_stage(pl,TASK_PIPELINE_SERIAL_IN_ORDER,&output_stage,&b);
+
+	double base = 0;
+	printf("%8s %14s %8s\n","threads","records/s","scaling");
+	for (unsigned int threads = 2; threads <= max_threads; threads *= 2)
+	{
+		scheduler_t sc = scheduler_create(threads);
+
+		b.m_next_in = b.m_next_out = 0;
+
+		uint64_t start = now_ns();
+		task_pipeline_run(pl,NULL);
+		double rate = b.m_records / ((now_ns() - start) / 1e9);
+
+		if (b.m_next_out != b.m_records)
+			abort();
+
+		// Relative to the 2 worker run
+		if (base == 0)
+			base = rate;
+		printf("%8u %14.0f %8.2f\n",threads,rate,rate / base);
+
+		scheduler_destroy(sc);
+	}
+
+	task_pipeline_destroy(pl);
+	free(b.m_pool);
+	return 0;
+}
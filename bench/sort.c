@@ -0,0 +1,136 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/sort.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Sorting random 64-bit keys: single threaded qsort against task_parallel_sort and the radix path
+// Then the same bytes again as 64-byte records, where the merge passes over memory cost the most
+
+struct Record
+{
+	uint64_t m_key;
+	uint64_t m_payload[7];
+};
+
+static uint64_t now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static int compare_u64(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+static int compare_record(const void* a, const void* b)
+{
+	return compare_u64(&((const struct Record*)a)->m_key,&((const struct Record*)b)->m_key);
+}
+
+static void fill(uint64_t* keys, size_t count)
+{
+	uint64_t v = 88172645463325252ULL;
+	for (size_t i = 0; i < count; ++i)
+	{
+		v ^= v << 13;
+		v ^= v >> 7;
+		v ^= v << 17;
+		keys[i] = v;
+	}
+}
+
+static void check(const uint64_t* keys, size_t count)
+{
+	for (size_t i = 1; i < count; ++i)
+	{
+		if (keys[i-1] > keys[i])
+			abort();
+	}
+}
+
+static void fill_records(struct Record* records, size_t count, uint64_t* keys)
+{
+	fill(keys,count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		records[i].m_key = keys[i];
+		records[i].m_payload[0] = i;
+	}
+}
+
+static void check_records(const struct Record* records, size_t count)
+{
+	for (size_t i = 1; i < count; ++i)
+	{
+		if (records[i-1].m_key > records[i].m_key)
+			abort();
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+	size_t count = argc > 2 ? strtoull(argv[2],NULL,10) : 10000000;
+
+	uint64_t* keys = malloc(count * sizeof(uint64_t));
+	size_t record_count = count * sizeof(uint64_t) / sizeof(struct Record);
+	struct Record* records = malloc(record_count * sizeof(struct Record));
+	if (!keys || !records)
+		abort();
+
+	fill(keys,count);
+	uint64_t start = now_ns();
+	qsort(keys,count,sizeof(uint64_t),&compare_u64);
+	double qsort_ms = (now_ns() - start) / 1e6;
+	check(keys,count);
+
+	fill_records(records,record_count,keys);
+	start = now_ns();
+	qsort(records,record_count,sizeof(struct Record),&compare_record);
+	double qsort_records_ms = (now_ns() - start) / 1e6;
+	check_records(records,record_count);
+
+	printf("%zu keys, qsort: %.1f ms\n",count,qsort_ms);
+	printf("%zu records, qsort: %.1f ms\n",record_count,qsort_records_ms);
+	printf("%8s %12s %8s %12s %8s %12s %8s\n","threads","sort ms","x qsort","radix ms","x qsort","records ms","x qsort");
+	// qsort is the single thread baseline, the scheduler always has at least 2 workers
+	for (unsigned int threads = 2; threads <= max_threads; threads *= 2)
+	{
+		scheduler_t sc = scheduler_create(threads);
+
+		fill(keys,count);
+		start = now_ns();
+		task_parallel_sort(NULL,keys,count,sizeof(uint64_t),&compare_u64);
+		double sort_ms = (now_ns() - start) / 1e6;
+		check(keys,count);
+
+		fill(keys,count);
+		start = now_ns();
+		task_parallel_sort_u64(NULL,keys,count);
+		double radix_ms = (now_ns() - start) / 1e6;
+		check(keys,count);
+
+		fill_records(records,record_count,keys);
+		start = now_ns();
+		task_parallel_sort(NULL,records,record_count,sizeof(struct Record),&compare_record);
+		double records_ms = (now_ns() - start) / 1e6;
+		check_records(records,record_count);
+
+		printf("%8u %12.1f %8.2f %12.1f %8.2f %12.1f %8.2f\n",threads,sort_ms,qsort_ms / sort_ms,radix_ms,qsort_ms / radix_ms,records_ms,qsort_records_ms / records_ms);
+
+		scheduler_destroy(sc);
+	}
+
+	free(records);
+	free(keys);
+	return 0;
+}
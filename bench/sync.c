@@ -0,0 +1,133 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/sync.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+// Contended lock benchmark: many tasks repeatedly taking one lock,
+// either blocking their worker on a pthread mutex, or parking a continuation on a task_mutex_t
+
+struct Bench
+{
+	task_t          m_root;
+	unsigned int    m_rounds;
+	unsigned int    m_work;
+	pthread_mutex_t m_pmutex;
+	task_mutex_t    m_tmutex;
+	volatile unsigned long m_counter;
+};
+
+struct Run
+{
+	struct Bench* m_bench;
+	unsigned int  m_tasks;
+};
+
+struct Chain
+{
+	struct Bench* m_bench;
+	unsigned int  m_rounds;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void critical_section(struct Bench* b)
+{
+	for (unsigned int i = 0; i < b->m_work; ++i)
+		++b->m_counter;
+}
+
+static void pthread_task(task_t task, void* param)
+{
+	struct Bench* b = *(struct Bench**)param;
+
+	for (unsigned int i = 0; i < b->m_rounds; ++i)
+	{
+		pthread_mutex_lock(&b->m_pmutex);
+		critical_section(b);
+		pthread_mutex_unlock(&b->m_pmutex);
+	}
+}
+
+static void tmutex_task(task_t task, void* param)
+{
+	struct Chain c = *(struct Chain*)param;
+
+	critical_section(c.m_bench);
+	task_mutex_unlock(c.m_bench->m_tmutex);
+
+	if (--c.m_rounds)
+		task_mutex_lock(c.m_bench->m_tmutex,c.m_bench->m_root,&tmutex_task,&c,sizeof(c));
+}
+
+static void pthread_root(task_t task, void* param)
+{
+	struct Run* r = param;
+
+	for (unsigned int i = 0; i < r->m_tasks; ++i)
+		task_run(task,&pthread_task,&r->m_bench,sizeof(r->m_bench));
+}
+
+static void tmutex_root(task_t task, void* param)
+{
+	struct Run* r = param;
+
+	// Chains are parented on the root, so their continuations do not pin every ancestor
+	r->m_bench->m_root = task;
+	struct Chain c = { r->m_bench, r->m_bench->m_rounds };
+	for (unsigned int i = 0; i < r->m_tasks; ++i)
+		task_mutex_lock(r->m_bench->m_tmutex,task,&tmutex_task,&c,sizeof(c));
+}
+
+static double run(task_fn_t root, struct Bench* b, unsigned int tasks)
+{
+	struct Run r = { b, tasks };
+
+	b->m_counter = 0;
+
+	uint64_t start = now_ns();
+	task_join(task_run(NULL,root,&r,sizeof(r)));
+	uint64_t elapsed = now_ns() - start;
+
+	if (b->m_counter != (unsigned long)tasks * b->m_rounds * b->m_work)
+		abort();
+
+	return (double)tasks * b->m_rounds / ((double)elapsed / 1e9);
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+	unsigned int tasks = argc > 2 ? atoi(argv[2]) : 256;
+	unsigned int rounds = argc > 3 ? atoi(argv[3]) : 1000;
+
+	struct Bench b = { .m_rounds = rounds, .m_work = 64 };
+	pthread_mutex_init(&b.m_pmutex,NULL);
+	b.m_tmutex = task_mutex_create();
+
+	printf("%8s %16s %16s\n","threads","pthread lock/s","task_mutex lock/s");
+	for (unsigned int threads = 2; threads <= max_threads; threads *= 2)
+	{
+		scheduler_t sc = scheduler_create(threads);
+
+		double p = run(&pthread_root,&b,tasks);
+		double t = run(&tmutex_root,&b,tasks);
+		printf("%8u %16.0f %16.0f\n",threads,p,t);
+
+		scheduler_destroy(sc);
+	}
+
+	task_mutex_destroy(b.m_tmutex);
+	pthread_mutex_destroy(&b.m_pmutex);
+	return 0;
+}
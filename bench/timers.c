@@ -0,0 +1,198 @@
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/proactor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// Timer insert, cancel and expiry rates through the public proactor API
+// Commands are handled in order, so a zero timeout timer queued last marks the end of each phase
+
+static atomic_uint s_fired;
+static atomic_int s_done;
+static atomic_uint_fast64_t s_last_ms;
+static atomic_uint s_wakeups;
+
+static uint64_t now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static uint64_t cpu_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void fire_fn(task_t task, void* param)
+{
+	atomic_fetch_add_explicit(&s_fired,1,memory_order_relaxed);
+}
+
+// Counts the distinct milliseconds in which timers fire, which tracks the proactor wakeups
+static void spread_fn(task_t task, void* param)
+{
+	uint64_t ms = now_ns() / 1000000;
+	if (atomic_exchange(&s_last_ms,ms) != ms)
+		atomic_fetch_add_explicit(&s_wakeups,1,memory_order_relaxed);
+
+	atomic_fetch_add_explicit(&s_fired,1,memory_order_relaxed);
+}
+
+// Lateness histogram, in power of two microsecond buckets
+#define LATE_BUCKETS 16
+static atomic_uint s_late[LATE_BUCKETS];
+
+static void late_fn(task_t task, void* param)
+{
+	uint64_t late = now_ns() - *(const uint64_t*)param;
+
+	unsigned int b = 0;
+	while (b < LATE_BUCKETS - 1 && (UINT64_C(1000) << b) <= late)
+		++b;
+
+	atomic_fetch_add_explicit(&s_late[b],1,memory_order_relaxed);
+	atomic_fetch_add_explicit(&s_fired,1,memory_order_relaxed);
+}
+
+static void done_fn(task_t task, void* param)
+{
+	atomic_store(&s_done,1);
+}
+
+// The main thread is a worker, but must not run tasks while the proactor owns one of them
+static void wait_done(proactor_t pr)
+{
+	atomic_store(&s_done,0);
+	proactor_add_timer(pr,0,0,0,NULL,&done_fn,NULL,0);
+
+	struct timespec ts = { 0, 100000 };
+	while (!atomic_load(&s_done))
+		nanosleep(&ts,NULL);
+}
+
+static void report(const char* phase, unsigned int count, uint64_t start)
+{
+	double secs = (now_ns() - start) / 1e9;
+	printf("%-8s %10u %12.1f %14.0f\n",phase,count,secs * 1e3,count / secs);
+}
+
+int main(int argc, char* argv[])
+{
+	unsigned int count = argc > 1 ? strtoul(argv[1],NULL,10) : 1000000;
+
+	unsigned int* ids = malloc(count * sizeof(unsigned int));
+	if (!ids)
+		abort();
+
+	// The proactor loop occupies one worker for good, the callbacks need the others
+	scheduler_t sc = scheduler_create(4);
+	proactor_t pr = proactor_create(NULL);
+
+	printf("%-8s %10s %12s %14s\n","phase","timers","ms","ops/s");
+
+	// Long timeouts, spread out so the heap is properly shuffled
+	uint64_t start = now_ns();
+	for (unsigned int i = 0; i < count; ++i)
+		ids[i] = proactor_add_timer(pr,3600000 + (i * 7919u) % 3600000,0,0,NULL,&fire_fn,NULL,0);
+	wait_done(pr);
+	report("insert",count,start);
+
+	// Re-arming timeouts, as a busy server does for every request
+	start = now_ns();
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		proactor_cancel_timer(pr,ids[i]);
+		ids[i] = proactor_add_timer(pr,3600000 + (i * 104729u) % 3600000,0,0,NULL,&fire_fn,NULL,0);
+	}
+	wait_done(pr);
+	report("churn",count,start);
+
+	start = now_ns();
+	for (unsigned int i = 0; i < count; ++i)
+		proactor_cancel_timer(pr,ids[i]);
+	wait_done(pr);
+	report("cancel",count,start);
+
+	// Short timeouts, which all expire
+	start = now_ns();
+	for (unsigned int i = 0; i < count; ++i)
+		proactor_add_timer(pr,1 + i % 64,0,0,NULL,&fire_fn,NULL,0);
+
+	struct timespec ts = { 0, 100000 };
+	while (atomic_load(&s_fired) < count)
+		nanosleep(&ts,NULL);
+	report("expire",count,start);
+
+	// Idle timeouts spread over a second, exact and then with slack
+	unsigned int spread = count < 100000 ? count : 100000;
+	printf("\n%-8s %10s %12s %14s\n","slack","timers","cpu ms","fire ms");
+	for (uint32_t slack = 0; slack <= 256; slack = slack ? slack * 4 : 4)
+	{
+		atomic_store(&s_fired,0);
+		atomic_store(&s_wakeups,0);
+
+		start = cpu_ns();
+		for (unsigned int i = 0; i < spread; ++i)
+			proactor_add_timer(pr,(i * 7919u) % 1000,0,slack,NULL,&spread_fn,NULL,0);
+
+		while (atomic_load(&s_fired) < spread)
+			nanosleep(&ts,NULL);
+		printf("%-8u %10u %12.1f %14u\n",slack,spread,(cpu_ns() - start) / 1e6,atomic_load(&s_wakeups));
+	}
+
+	// Short timers, one at a time, through the millisecond and the nanosecond calls
+	// A millisecond of slack opts the 200us timer out of the precise wait, as a coarse baseline for the same deadline
+	unsigned int late_count = 1000;
+	unsigned int late[3][LATE_BUCKETS];
+	for (int ns = 0; ns < 3; ++ns)
+	{
+		for (unsigned int b = 0; b < LATE_BUCKETS; ++b)
+			atomic_store(&s_late[b],0);
+		atomic_store(&s_fired,0);
+
+		for (unsigned int i = 0; i < late_count; ++i)
+		{
+			uint64_t deadline;
+			if (ns)
+			{
+				deadline = now_ns() + 200000;
+				proactor_add_timer_ns(pr,200000,0,ns == 1 ? 1000000 : 0,NULL,&late_fn,&deadline,sizeof(deadline));
+			}
+			else
+			{
+				deadline = now_ns() + 1000000;
+				proactor_add_timer(pr,1,0,0,NULL,&late_fn,&deadline,sizeof(deadline));
+			}
+
+			while (atomic_load(&s_fired) <= i)
+				nanosleep(&ts,NULL);
+		}
+
+		for (unsigned int b = 0; b < LATE_BUCKETS; ++b)
+			late[ns][b] = atomic_load(&s_late[b]);
+	}
+
+	printf("\n%-10s %10s %12s %10s\n","late by","1ms","200us coarse","200us ns");
+	for (unsigned int b = 0; b < LATE_BUCKETS; ++b)
+	{
+		if (late[0][b] || late[1][b] || late[2][b])
+		{
+			char label[16];
+			snprintf(label,sizeof(label),b == LATE_BUCKETS - 1 ? ">= %uus" : "< %uus",b == LATE_BUCKETS - 1 ? 1u << (b - 1) : 1u << b);
+			printf("%-10s %10u %12u %10u\n",label,late[0][b],late[1][b],late[2][b]);
+		}
+	}
+
+	proactor_destroy(pr);
+	scheduler_destroy(sc);
+	free(ids);
+	return 0;
+}
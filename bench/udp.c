@@ -0,0 +1,259 @@
+
+#define _GNU_SOURCE
+
+#include "../src/proactor.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Loopback UDP packet rates: a recv watcher reading one datagram per wakeup against proactor_recv_datagrams(),
+// and a proactor_send() per datagram against proactor_send_datagrams()
+
+#define PACKET_SIZE 64
+#define BATCH_MAX 256
+#define SEND_WINDOW 256
+
+static proactor_t s_pr;
+static int s_rx;
+static int s_tx;
+static unsigned int s_batch;
+static uint64_t s_packets;
+
+static atomic_uint_fast64_t s_count;
+static atomic_uint_fast64_t s_last_ns;
+static atomic_int s_done;
+
+static struct mmsghdr s_msgs[BATCH_MAX];
+static struct iovec s_iovs[BATCH_MAX];
+static char s_bufs[BATCH_MAX][PACKET_SIZE];
+
+static uint64_t now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC,&t);
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void wait_ns(uint64_t ns)
+{
+	struct timespec ts = { ns / 1000000000, ns % 1000000000 };
+	nanosleep(&ts,NULL);
+}
+
+static int udp_socket(int non_blocking)
+{
+	int s = socket(AF_INET,SOCK_DGRAM | SOCK_CLOEXEC | (non_blocking ? SOCK_NONBLOCK : 0),0);
+	if (s == -1)
+		abort();
+
+	int size = 8 << 20;
+	setsockopt(s,SOL_SOCKET,SO_RCVBUF,&size,sizeof(size));
+	setsockopt(s,SOL_SOCKET,SO_SNDBUF,&size,sizeof(size));
+	return s;
+}
+
+static void connect_pair()
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	socklen_t len = sizeof(addr);
+	if (bind(s_rx,(struct sockaddr*)&addr,len) != 0 || getsockname(s_rx,(struct sockaddr*)&addr,&len) != 0 || connect(s_tx,(struct sockaddr*)&addr,len) != 0)
+		abort();
+}
+
+static void init_msgs(unsigned int count)
+{
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		s_iovs[i].iov_base = s_bufs[i];
+		s_iovs[i].iov_len = PACKET_SIZE;
+		memset(&s_msgs[i],0,sizeof(s_msgs[i]));
+		s_msgs[i].msg_hdr.msg_iov = &s_iovs[i];
+		s_msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+static void received(uint64_t count)
+{
+	atomic_fetch_add_explicit(&s_count,count,memory_order_relaxed);
+	atomic_store_explicit(&s_last_ns,now_ns(),memory_order_relaxed);
+}
+
+static void watcher_fn(task_t task, void* param)
+{
+	char buf[PACKET_SIZE];
+	if (recv(s_rx,buf,sizeof(buf),MSG_DONTWAIT) > 0)
+		received(1);
+
+	if (!atomic_load(&s_done))
+		proactor_add_recv_watcher(s_pr,s_rx,NULL,&watcher_fn,NULL,0);
+}
+
+static void datagrams_fn(task_t task, void* param)
+{
+	struct proactor_completion* c = param;
+	if (!c->m_result)
+		received(c->m_bytes);
+
+	if (!atomic_load(&s_done))
+		proactor_recv_datagrams(s_pr,s_rx,s_msgs,s_batch,NULL,&datagrams_fn,NULL,0);
+}
+
+// Blasts the packets from a plain thread, as fast as the kernel takes them
+static void* sender(void* param)
+{
+	struct mmsghdr msgs[BATCH_MAX];
+	struct iovec iov = { s_bufs[0], PACKET_SIZE };
+	memset(msgs,0,sizeof(msgs));
+	for (unsigned int i = 0; i < BATCH_MAX; ++i)
+	{
+		msgs[i].msg_hdr.msg_iov = &iov;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	for (uint64_t sent = 0; sent < s_packets; )
+	{
+		unsigned int n = s_packets - sent < BATCH_MAX ? s_packets - sent : BATCH_MAX;
+		int r = sendmmsg(s_tx,msgs,n,0);
+		if (r > 0)
+			sent += r;
+	}
+	return NULL;
+}
+
+// Receive rate up to the last packet to arrive, losses are what the receiver couldn't keep up with
+static void run_recv(const char* name, int batched)
+{
+	s_rx = udp_socket(1);
+	s_tx = udp_socket(0);
+	connect_pair();
+	init_msgs(s_batch);
+	atomic_store(&s_count,0);
+	atomic_store(&s_done,0);
+
+	uint64_t start = now_ns();
+	atomic_store(&s_last_ns,start);
+	if (batched)
+		proactor_recv_datagrams(s_pr,s_rx,s_msgs,s_batch,NULL,&datagrams_fn,NULL,0);
+	else
+		proactor_add_recv_watcher(s_pr,s_rx,NULL,&watcher_fn,NULL,0);
+
+	pthread_t thread;
+	pthread_create(&thread,NULL,&sender,NULL);
+	pthread_join(thread,NULL);
+
+	// Done once nothing more has arrived for a while
+	while (atomic_load(&s_count) < s_packets && now_ns() - atomic_load(&s_last_ns) < 200000000)
+		wait_ns(1000000);
+
+	uint64_t count = atomic_load(&s_count);
+	double secs = (atomic_load(&s_last_ns) - start) / 1e9;
+	printf("%-24s %12.0f %10.1f%%\n",name,count / secs,100.0 * (s_packets - count) / s_packets);
+
+	// Give a running task the time to see it is done, then whatever is still waiting goes
+	atomic_store(&s_done,1);
+	wait_ns(10000000);
+	proactor_cancel_recv_watcher(s_pr,s_rx);
+	wait_ns(10000000);
+	close(s_rx);
+	close(s_tx);
+}
+
+static atomic_uint_fast64_t s_issued;
+
+static void send_fn(task_t task, void* param)
+{
+	struct proactor_completion* c = param;
+	uint64_t sent = atomic_fetch_add_explicit(&s_count,s_batch ? c->m_bytes : 1,memory_order_relaxed) + (s_batch ? c->m_bytes : 1);
+	if (c->m_result)
+		abort();
+
+	if (sent >= s_packets)
+	{
+		atomic_store(&s_done,1);
+		return;
+	}
+
+	uint64_t step = s_batch ? s_batch : 1;
+	if (atomic_fetch_add_explicit(&s_issued,step,memory_order_relaxed) < s_packets)
+	{
+		if (s_batch)
+			proactor_send_datagrams(s_pr,s_tx,s_msgs,s_batch,NULL,&send_fn,NULL,0);
+		else
+			proactor_send(s_pr,s_tx,s_bufs[0],PACKET_SIZE,NULL,&send_fn,NULL,0);
+	}
+}
+
+// Keeps a window of sends in flight, each completion issues the next
+static void run_send(const char* name, unsigned int batch)
+{
+	s_rx = udp_socket(1);
+	s_tx = udp_socket(1);
+	connect_pair();
+	init_msgs(BATCH_MAX);
+	atomic_store(&s_count,0);
+	atomic_store(&s_done,0);
+
+	// Sends of one batch share the array, which is only read
+	s_batch = batch;
+	unsigned int window = batch ? 1 : SEND_WINDOW;
+	atomic_store(&s_issued,(uint64_t)window * (batch ? batch : 1));
+
+	uint64_t start = now_ns();
+	for (unsigned int i = 0; i < window; ++i)
+	{
+		if (batch)
+			proactor_send_datagrams(s_pr,s_tx,s_msgs,batch,NULL,&send_fn,NULL,0);
+		else
+			proactor_send(s_pr,s_tx,s_bufs[0],PACKET_SIZE,NULL,&send_fn,NULL,0);
+	}
+
+	while (!atomic_load(&s_done))
+		wait_ns(100000);
+
+	double secs = (now_ns() - start) / 1e9;
+	printf("%-24s %12.0f\n",name,atomic_load(&s_count) / secs);
+
+	// Let the window drain before the sockets go
+	wait_ns(50000000);
+	close(s_rx);
+	close(s_tx);
+}
+
+int main(int argc, char* argv[])
+{
+	s_packets = argc > 1 ? strtoull(argv[1],NULL,10) : 2000000;
+	unsigned int batch = argc > 2 ? atoi(argv[2]) : 64;
+	if (batch < 1 || batch > BATCH_MAX)
+		batch = 64;
+
+	// The proactor occupies one worker
+	scheduler_t sc = scheduler_create(4);
+	s_pr = proactor_create(NULL);
+
+	char name[32];
+	printf("%" PRIu64 " packets of %u bytes\n",s_packets,PACKET_SIZE);
+	printf("%-24s %12s %11s\n","receive","packets/s","lost");
+	s_batch = batch;
+	run_recv("watcher",0);
+	snprintf(name,sizeof(name),"recv_datagrams x%u",batch);
+	run_recv(name,1);
+
+	printf("%-24s %12s\n","send","packets/s");
+	run_send("send",0);
+	snprintf(name,sizeof(name),"send_datagrams x%u",batch);
+	run_send(name,batch);
+
+	proactor_destroy(s_pr);
+	scheduler_destroy(sc);
+	return 0;
+}
@@ -0,0 +1,325 @@
+
+#include "channel.h"
+#include "ring.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+struct ChannelWaiter
+{
+	struct ChannelWaiter* m_next;
+	task_t                m_parent;
+	task_fn_t             m_fn;
+	unsigned int          m_param_len;
+
+	_Alignas(max_align_t) char m_param[];
+};
+
+enum ConsumerState
+{
+	CONSUMER_IDLE,
+	CONSUMER_RUNNING,
+	CONSUMER_RERUN
+};
+
+struct ChannelWaiters
+{
+	// A LIFO of parked continuations, only the thread that raised m_wakes from zero pops from it
+	_Atomic(struct ChannelWaiter*) m_head;
+	atomic_size_t                  m_wakes;
+};
+
+struct Channel
+{
+	struct Ring m_ring;
+
+	struct ChannelWaiters m_send_waiters;
+	struct ChannelWaiters m_recv_waiters;
+
+	atomic_uint  m_consumer_state;
+	task_t       m_consumer_parent;
+	task_fn_t    m_consumer_fn;
+
+	_Alignas(max_align_t) char m_consumer_param[TASK_PARAM_MAX];
+};
+
+// Wakes up to n waiters, one for each element or slot that has turned up
+static void channelWake(struct ChannelWaiters* waiters, size_t n)
+{
+	// Cheap check first, this is on every send and receive
+	if (!atomic_load_explicit(&waiters->m_head,memory_order_relaxed))
+		return;
+
+	// Whoever is already popping wakes our share too
+	if (atomic_fetch_add_explicit(&waiters->m_wakes,n,memory_order_acq_rel) != 0)
+		return;
+
+	do
+	{
+		for (size_t i = 0; i < n; ++i)
+		{
+			// With a single popper a node cannot be freed and reused under us
+			struct ChannelWaiter* w = atomic_load_explicit(&waiters->m_head,memory_order_acquire);
+			while (w && !atomic_compare_exchange_weak_explicit(&waiters->m_head,&w,w->m_next,memory_order_acquire,memory_order_acquire))
+				;
+
+			if (!w)
+				break;
+
+			if (!task_run(w->m_parent,w->m_fn,w->m_param,w->m_param_len))
+				abort();
+
+			task_release(w->m_parent);
+			free(w);
+		}
+	}
+	while ((n = atomic_fetch_sub_explicit(&waiters->m_wakes,n,memory_order_acq_rel) - n) != 0);
+}
+
+static int channelPark(struct ChannelWaiters* waiters, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (!fn || param_len > TASK_PARAM_MAX)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct ChannelWaiter* w = malloc(sizeof(struct ChannelWaiter) + param_len);
+	if (!w)
+		abort();
+
+	if (task_retain(pt) != 0)
+	{
+		free(w);
+		return -1;
+	}
+
+	w->m_parent = pt;
+	w->m_fn = fn;
+	w->m_param_len = param_len;
+	memcpy(w->m_param,param,param_len);
+
+	w->m_next = atomic_load_explicit(&waiters->m_head,memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&waiters->m_head,&w->m_next,w,memory_order_release,memory_order_relaxed))
+		;
+
+	return 0;
+}
+
+static void channelConsume(task_t task, void* param);
+
+static void channelRunConsumer(struct Channel* ch)
+{
+	if (!task_run(ch->m_consumer_parent,&channelConsume,&ch,sizeof(ch)))
+		abort();
+}
+
+static void channelConsume(task_t task, void* param)
+{
+	struct Channel* ch = *(struct Channel**)param;
+
+	(*ch->m_consumer_fn)(task,ch->m_consumer_param);
+
+	unsigned int state = CONSUMER_RUNNING;
+	if (!atomic_compare_exchange_strong(&ch->m_consumer_state,&state,CONSUMER_IDLE))
+	{
+		// Something arrived while we were running, senders leave CONSUMER_RERUN alone
+		atomic_store(&ch->m_consumer_state,CONSUMER_RUNNING);
+		channelRunConsumer(ch);
+		return;
+	}
+
+	// The consumer might not have drained everything
+	atomic_thread_fence(memory_order_seq_cst);
+	state = CONSUMER_IDLE;
+	if (!ringEmpty(&ch->m_ring) && atomic_compare_exchange_strong(&ch->m_consumer_state,&state,CONSUMER_RUNNING))
+		channelRunConsumer(ch);
+}
+
+static void channelSent(struct Channel* ch, size_t n)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+
+	channelWake(&ch->m_recv_waiters,n);
+
+	if (ch->m_consumer_fn)
+	{
+		unsigned int state = atomic_load_explicit(&ch->m_consumer_state,memory_order_relaxed);
+		for (;;)
+		{
+			if (state == CONSUMER_RERUN)
+				break;
+
+			if (atomic_compare_exchange_weak(&ch->m_consumer_state,&state,state == CONSUMER_IDLE ? CONSUMER_RUNNING : CONSUMER_RERUN))
+			{
+				if (state == CONSUMER_IDLE)
+					channelRunConsumer(ch);
+				break;
+			}
+		}
+	}
+}
+
+static void channelReceived(struct Channel* ch, size_t n)
+{
+	atomic_thread_fence(memory_order_seq_cst);
+
+	channelWake(&ch->m_send_waiters,n);
+}
+
+unsigned int task_channel_send_n(task_channel_t chh, const void* elems, unsigned int n)
+{
+	struct Channel* ch = (struct Channel*)chh;
+	unsigned int sent = 0;
+	while (sent < n)
+	{
+		size_t s = ringSend(&ch->m_ring,(const unsigned char*)elems + (sent * ch->m_ring.m_elem_size),n - sent);
+		if (!s)
+			break;
+		sent += s;
+	}
+
+	if (sent)
+		channelSent(ch,sent);
+
+	return sent;
+}
+
+unsigned int task_channel_recv_n(task_channel_t chh, void* elems, unsigned int n)
+{
+	struct Channel* ch = (struct Channel*)chh;
+	unsigned int recvd = 0;
+	while (recvd < n)
+	{
+		size_t r = ringRecv(&ch->m_ring,(unsigned char*)elems + (recvd * ch->m_ring.m_elem_size),n - recvd);
+		if (!r)
+			break;
+		recvd += r;
+	}
+
+	if (recvd)
+		channelReceived(ch,recvd);
+
+	return recvd;
+}
+
+int task_channel_try_send(task_channel_t ch, const void* elem)
+{
+	return task_channel_send_n(ch,elem,1);
+}
+
+int task_channel_try_recv(task_channel_t ch, void* elem)
+{
+	return task_channel_recv_n(ch,elem,1);
+}
+
+int task_channel_send(task_channel_t chh, const void* elem, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	struct Channel* ch = (struct Channel*)chh;
+
+	if (task_channel_send_n(chh,elem,1))
+		return 1;
+
+	if (channelPark(&ch->m_send_waiters,pt,fn,param,param_len) != 0)
+		return -1;
+
+	// A receiver may have made space before it could see us
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!ringFull(&ch->m_ring))
+		channelWake(&ch->m_send_waiters,1);
+
+	return 0;
+}
+
+int task_channel_recv(task_channel_t chh, void* elem, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	struct Channel* ch = (struct Channel*)chh;
+
+	if (task_channel_recv_n(chh,elem,1))
+		return 1;
+
+	if (channelPark(&ch->m_recv_waiters,pt,fn,param,param_len) != 0)
+		return -1;
+
+	// A sender may have added something before it could see us
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!ringEmpty(&ch->m_ring))
+		channelWake(&ch->m_recv_waiters,1);
+
+	return 0;
+}
+
+int task_channel_set_consumer(task_channel_t chh, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	struct Channel* ch = (struct Channel*)chh;
+	if (!ch || !fn || param_len > TASK_PARAM_MAX || ch->m_consumer_fn)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	ch->m_consumer_parent = pt;
+	memcpy(ch->m_consumer_param,param,param_len);
+	ch->m_consumer_fn = fn;
+
+	// Pick up anything sent already
+	if (!ringEmpty(&ch->m_ring))
+		channelSent(ch,0);
+
+	return 0;
+}
+
+task_channel_t task_channel_create(unsigned int capacity, unsigned int elem_size)
+{
+	if (!capacity || !elem_size)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct Channel* ch = malloc(sizeof(struct Channel));
+	if (!ch)
+		abort();
+
+	ringInit(&ch->m_ring,capacity,elem_size);
+	atomic_init(&ch->m_send_waiters.m_head,NULL);
+	atomic_init(&ch->m_send_waiters.m_wakes,0);
+	atomic_init(&ch->m_recv_waiters.m_head,NULL);
+	atomic_init(&ch->m_recv_waiters.m_wakes,0);
+	atomic_init(&ch->m_consumer_state,CONSUMER_IDLE);
+	ch->m_consumer_parent = NULL;
+	ch->m_consumer_fn = NULL;
+
+	return (task_channel_t)ch;
+}
+
+static void channelDiscard(struct ChannelWaiters* waiters)
+{
+	struct ChannelWaiter* w = atomic_exchange(&waiters->m_head,NULL);
+	while (w)
+	{
+		struct ChannelWaiter* next = w->m_next;
+		task_release(w->m_parent);
+		free(w);
+		w = next;
+	}
+}
+
+void task_channel_destroy(task_channel_t chh)
+{
+	struct Channel* ch = (struct Channel*)chh;
+	if (ch)
+	{
+		// Let a running consumer finish
+		while (atomic_load(&ch->m_consumer_state) != CONSUMER_IDLE)
+			task_work();
+
+		channelDiscard(&ch->m_send_waiters);
+		channelDiscard(&ch->m_recv_waiters);
+		ringDestroy(&ch->m_ring);
+		free(ch);
+	}
+}
@@ -0,0 +1,30 @@
+
+#ifndef SRC_CHANNEL_H_
+#define SRC_CHANNEL_H_
+
+#include "task.h"
+
+typedef struct opaque_task_channel_t
+{
+	int _unused;
+}* task_channel_t;
+
+task_channel_t task_channel_create(unsigned int capacity, unsigned int elem_size);
+void task_channel_destroy(task_channel_t ch);
+
+int task_channel_try_send(task_channel_t ch, const void* elem);
+int task_channel_try_recv(task_channel_t ch, void* elem);
+
+// Batched variants, return the number of elements transferred
+unsigned int task_channel_send_n(task_channel_t ch, const void* elems, unsigned int n);
+unsigned int task_channel_recv_n(task_channel_t ch, void* elems, unsigned int n);
+
+// Return 1 on success. If the channel is full (or empty) return 0 instead, and fn
+// is run as a task once it is worth trying again, rather than spinning. pt is held open while fn is parked
+int task_channel_send(task_channel_t ch, const void* elem, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+int task_channel_recv(task_channel_t ch, void* elem, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+
+// fn is run as a task when items arrive and it is not already running, it should drain the channel
+int task_channel_set_consumer(task_channel_t ch, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+
+#endif /* SRC_CHANNEL_H_ */
@@ -0,0 +1,73 @@
+
+#ifndef SRC_MPSC_H_
+#define SRC_MPSC_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+// Intrusive multi-producer, single-consumer FIFO
+// See http://www.1024cores.net/home/lock-free-algorithms/queues/intrusive-mpsc-node-based-queue for details
+
+struct MpscNode
+{
+	_Atomic(struct MpscNode*) m_next;
+};
+
+struct MpscQueue
+{
+	_Atomic(struct MpscNode*) m_head;
+	struct MpscNode*          m_tail;
+	struct MpscNode           m_stub;
+};
+
+static inline void mpscInit(struct MpscQueue* q)
+{
+	atomic_init(&q->m_stub.m_next,NULL);
+	atomic_init(&q->m_head,&q->m_stub);
+	q->m_tail = &q->m_stub;
+}
+
+static inline void mpscPush(struct MpscQueue* q, struct MpscNode* n)
+{
+	atomic_store_explicit(&n->m_next,NULL,memory_order_relaxed);
+
+	struct MpscNode* prev = atomic_exchange_explicit(&q->m_head,n,memory_order_acq_rel);
+	atomic_store_explicit(&prev->m_next,n,memory_order_release);
+}
+
+// Returns NULL if the queue is empty, or if a producer is part way through a push
+static inline struct MpscNode* mpscPop(struct MpscQueue* q)
+{
+	struct MpscNode* tail = q->m_tail;
+	struct MpscNode* next = atomic_load_explicit(&tail->m_next,memory_order_acquire);
+	if (tail == &q->m_stub)
+	{
+		if (!next)
+			return NULL;
+
+		q->m_tail = tail = next;
+		next = atomic_load_explicit(&next->m_next,memory_order_acquire);
+	}
+
+	if (next)
+	{
+		q->m_tail = next;
+		return tail;
+	}
+
+	if (tail != atomic_load_explicit(&q->m_head,memory_order_acquire))
+		return NULL;
+
+	// Put the stub back so we can take the last real node
+	mpscPush(q,&q->m_stub);
+
+	next = atomic_load_explicit(&tail->m_next,memory_order_acquire);
+	if (next)
+	{
+		q->m_tail = next;
+		return tail;
+	}
+	return NULL;
+}
+
+#endif /* SRC_MPSC_H_ */
@@ -0,0 +1,275 @@
+
+#include "pipeline.h"
+#include "strand.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+struct Pipeline;
+
+// A token travels through the stages by value, as a task parameter
+struct Token
+{
+	struct Pipeline* m_pipeline;
+	void*            m_item;
+	size_t           m_seq;
+	unsigned int     m_stage;
+};
+
+struct Stage
+{
+	enum task_pipeline_mode m_mode;
+	task_pipeline_fn_t      m_fn;
+	void*                   m_param;
+
+	// Serial stages only
+	strand_t                m_strand;
+
+	// In-order stages only, tokens that arrived early, indexed by m_seq % m_max_tokens
+	size_t                  m_next_seq;
+	struct Token*           m_reorder;
+	unsigned char*          m_reorder_full;
+};
+
+struct Pipeline
+{
+	unsigned int  m_max_tokens;
+	unsigned int  m_stage_count;
+	struct Stage* m_stages;
+
+	task_t        m_root;
+	atomic_uint   m_tokens;
+	atomic_int    m_input_done;
+	size_t        m_input_seq;
+};
+
+static void pipelineParallel(task_t task, void* param);
+static void pipelineSerial(task_t task, void* param);
+static void pipelineInput(task_t task, void* param);
+
+static void pipelineRetire(struct Pipeline* pl)
+{
+	atomic_fetch_sub_explicit(&pl->m_tokens,1,memory_order_release);
+
+	// A token is free, so top up from the input
+	if (!atomic_load_explicit(&pl->m_input_done,memory_order_relaxed))
+		strand_post(pl->m_stages[0].m_strand,&pipelineInput,&pl,sizeof(pl));
+}
+
+// Hand the token on to its next stage, parallel stages run inline if we are not on a strand
+static void pipelineForward(struct Token* t, int on_strand)
+{
+	struct Pipeline* pl = t->m_pipeline;
+	while (t->m_stage < pl->m_stage_count)
+	{
+		struct Stage* st = &pl->m_stages[t->m_stage];
+		if (st->m_mode != TASK_PIPELINE_PARALLEL)
+		{
+			strand_post(st->m_strand,&pipelineSerial,t,sizeof(*t));
+			return;
+		}
+
+		if (on_strand)
+		{
+			if (!task_run(pl->m_root,&pipelineParallel,t,sizeof(*t)))
+				abort();
+			return;
+		}
+
+		// Dropped items still flow through, to keep in-order stages in step
+		if (t->m_item)
+			t->m_item = (*st->m_fn)(t->m_item,st->m_param);
+		++t->m_stage;
+	}
+
+	pipelineRetire(pl);
+}
+
+static void pipelineParallel(task_t task, void* param)
+{
+	struct Token t = *(struct Token*)param;
+	struct Stage* st = &t.m_pipeline->m_stages[t.m_stage];
+
+	if (t.m_item)
+		t.m_item = (*st->m_fn)(t.m_item,st->m_param);
+	++t.m_stage;
+
+	pipelineForward(&t,0);
+}
+
+static void pipelineSerial(task_t task, void* param)
+{
+	struct Token t = *(struct Token*)param;
+	struct Pipeline* pl = t.m_pipeline;
+	struct Stage* st = &pl->m_stages[t.m_stage];
+
+	if (st->m_mode == TASK_PIPELINE_SERIAL_IN_ORDER && t.m_seq != st->m_next_seq)
+	{
+		// Early, park it until its turn
+		size_t slot = t.m_seq % pl->m_max_tokens;
+		assert(!st->m_reorder_full[slot]);
+		st->m_reorder[slot] = t;
+		st->m_reorder_full[slot] = 1;
+		return;
+	}
+
+	for (;;)
+	{
+		if (t.m_item)
+			t.m_item = (*st->m_fn)(t.m_item,st->m_param);
+		++t.m_stage;
+
+		pipelineForward(&t,1);
+
+		if (st->m_mode != TASK_PIPELINE_SERIAL_IN_ORDER)
+			break;
+
+		// Release any tokens that were waiting on this one
+		size_t slot = ++st->m_next_seq % pl->m_max_tokens;
+		if (!st->m_reorder_full[slot])
+			break;
+
+		t = st->m_reorder[slot];
+		st->m_reorder_full[slot] = 0;
+	}
+}
+
+static void pipelineInput(task_t task, void* param)
+{
+	struct Pipeline* pl = *(struct Pipeline**)param;
+	struct Stage* st = &pl->m_stages[0];
+
+	// Only the input adds tokens, so check then add is safe
+	while (!atomic_load_explicit(&pl->m_input_done,memory_order_relaxed) && atomic_load_explicit(&pl->m_tokens,memory_order_acquire) < pl->m_max_tokens)
+	{
+		struct Token t = { pl, (*st->m_fn)(NULL,st->m_param), pl->m_input_seq++, 1 };
+		if (!t.m_item)
+		{
+			atomic_store_explicit(&pl->m_input_done,1,memory_order_relaxed);
+			break;
+		}
+
+		atomic_fetch_add_explicit(&pl->m_tokens,1,memory_order_relaxed);
+		pipelineForward(&t,1);
+	}
+}
+
+static void pipelineStart(task_t task, void* param)
+{
+	struct Pipeline* pl = *(struct Pipeline**)param;
+
+	pl->m_root = task;
+	for (unsigned int i = 0; i < pl->m_stage_count; ++i)
+	{
+		struct Stage* st = &pl->m_stages[i];
+		if (i == 0 || st->m_mode != TASK_PIPELINE_PARALLEL)
+			st->m_strand = strand_create(task);
+
+		st->m_next_seq = 0;
+		if (st->m_reorder_full)
+			memset(st->m_reorder_full,0,pl->m_max_tokens);
+	}
+
+	strand_post(pl->m_stages[0].m_strand,&pipelineInput,&pl,sizeof(pl));
+}
+
+int task_pipeline_run(task_pipeline_t ph, task_t pt)
+{
+	struct Pipeline* pl = (struct Pipeline*)ph;
+	if (!pl || !pl->m_stage_count)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	atomic_store(&pl->m_tokens,0);
+	atomic_store(&pl->m_input_done,0);
+	pl->m_input_seq = 0;
+
+	task_t t = task_run(pt,&pipelineStart,&pl,sizeof(pl));
+	if (!t)
+		return -1;
+
+	task_join(t);
+
+	for (unsigned int i = 0; i < pl->m_stage_count; ++i)
+	{
+		strand_destroy(pl->m_stages[i].m_strand);
+		pl->m_stages[i].m_strand = NULL;
+	}
+	return 0;
+}
+
+int task_pipeline_add_stage(task_pipeline_t ph, enum task_pipeline_mode mode, task_pipeline_fn_t fn, void* param)
+{
+	struct Pipeline* pl = (struct Pipeline*)ph;
+	if (!pl || !fn || mode > TASK_PIPELINE_SERIAL_OUT_OF_ORDER)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct Stage* new_stages = realloc(pl->m_stages,(pl->m_stage_count + 1) * sizeof(struct Stage));
+	if (!new_stages)
+		abort();
+	pl->m_stages = new_stages;
+
+	struct Stage* st = &pl->m_stages[pl->m_stage_count++];
+	st->m_mode = mode;
+	st->m_fn = fn;
+	st->m_param = param;
+	st->m_strand = NULL;
+	st->m_next_seq = 0;
+	st->m_reorder = NULL;
+	st->m_reorder_full = NULL;
+
+	if (mode == TASK_PIPELINE_SERIAL_IN_ORDER && pl->m_stage_count > 1)
+	{
+		st->m_reorder = malloc(pl->m_max_tokens * sizeof(struct Token));
+		st->m_reorder_full = calloc(pl->m_max_tokens,1);
+		if (!st->m_reorder || !st->m_reorder_full)
+			abort();
+	}
+	return 0;
+}
+
+task_pipeline_t task_pipeline_create(unsigned int max_tokens)
+{
+	if (!max_tokens)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct Pipeline* pl = malloc(sizeof(struct Pipeline));
+	if (!pl)
+		abort();
+
+	pl->m_max_tokens = max_tokens;
+	pl->m_stage_count = 0;
+	pl->m_stages = NULL;
+	pl->m_root = NULL;
+	atomic_init(&pl->m_tokens,0);
+	atomic_init(&pl->m_input_done,0);
+	pl->m_input_seq = 0;
+
+	return (task_pipeline_t)pl;
+}
+
+void task_pipeline_destroy(task_pipeline_t ph)
+{
+	struct Pipeline* pl = (struct Pipeline*)ph;
+	if (pl)
+	{
+		for (unsigned int i = 0; i < pl->m_stage_count; ++i)
+		{
+			free(pl->m_stages[i].m_reorder);
+			free(pl->m_stages[i].m_reorder_full);
+		}
+		free(pl->m_stages);
+		free(pl);
+	}
+}
@@ -0,0 +1,32 @@
+
+#ifndef SRC_PIPELINE_H_
+#define SRC_PIPELINE_H_
+
+#include "task.h"
+
+// A stage takes an item and returns the item to pass on, or NULL to drop it.
+// The first stage is the input: it is always called serially with a NULL item, and returns NULL at the end of the input
+typedef void* (*task_pipeline_fn_t)(void* item, void* param);
+
+enum task_pipeline_mode
+{
+	TASK_PIPELINE_PARALLEL,
+	TASK_PIPELINE_SERIAL_IN_ORDER,
+	TASK_PIPELINE_SERIAL_OUT_OF_ORDER
+};
+
+typedef struct opaque_task_pipeline_t
+{
+	int _unused;
+}* task_pipeline_t;
+
+// At most max_tokens items are in flight at once
+task_pipeline_t task_pipeline_create(unsigned int max_tokens);
+void task_pipeline_destroy(task_pipeline_t pl);
+
+int task_pipeline_add_stage(task_pipeline_t pl, enum task_pipeline_mode mode, task_pipeline_fn_t fn, void* param);
+
+// Runs until the input is exhausted, and every item has left the pipeline
+int task_pipeline_run(task_pipeline_t pl, task_t pt);
+
+#endif /* SRC_PIPELINE_H_ */
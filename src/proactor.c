@@ -5,13 +5,22 @@
  *      Author: rick
  */
 
+// For recvmmsg(), sendmmsg() and accept4()
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include "proactor.h"
+#include "threads.h"
+#include "ring.h"
 
 #include <stdatomic.h>
 #include <assert.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <limits.h>
 
 #if defined(_WIN32)
 #include <realtimeapiset.h>
@@ -30,54 +39,374 @@
 #include <time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#endif
 
 #define POLL_EVENT_RD POLLIN
 #define POLL_EVENT_WR POLLOUT
 #endif
 
+// Linux uses epoll, everything else falls back to poll()
+#if defined(__linux__) && !defined(PROACTOR_USE_POLL)
+#define PROACTOR_EPOLL 1
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+// EPOLLIN/EPOLLOUT share their values with POLLIN/POLLOUT
+#define EPOLL_BATCH 256
+#endif
+
+// io_uring for completion based i/o, if the kernel allows it at runtime
+#if defined(PROACTOR_EPOLL) && !defined(PROACTOR_NO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include "uring.h"
+
+// Socket operations need the kernel to poll internally, rather than block a worker thread
+#if defined(IORING_FEAT_FAST_POLL)
+#define PROACTOR_URING 1
+#define URING_ENTRIES 256
+#endif
+#endif
+#endif
+
+#if !defined(MSG_NOSIGNAL)
+#define MSG_NOSIGNAL 0
+#endif
+
+#if !defined(MSG_DONTWAIT)
+#define MSG_DONTWAIT 0
+#endif
+
 #if defined(_WIN32)
 typedef ULONG nfds_t;
 #else
 #define closesocket(s) close(s)
 #endif
 
-struct Watcher;
+#define TIMER_SMALL_PARAM 16
 
 struct Timer
 {
-	uint64_t        m_deadline;
-	struct Watcher* m_watcher;
+	union
+	{
+		size_t        m_heap_index;
+		struct Timer* m_next_free;
+	};
+
+	// The watcher this times out, if any
+	socket_t        m_fd;
+	unsigned int    m_flags;
+
 	task_t          m_parent;
 	task_fn_t       m_fn;
-	uint32_t        m_repeat;
+	uint64_t        m_repeat;
+	uint64_t        m_slack;
 	unsigned int    m_id;
 	unsigned int    m_param_len;
-	char            m_param[TASK_PARAM_MAX];
+	int             m_precise;
+
+	// Small params are kept inline, and a timed watcher's timeout runs with the watcher's
+	union
+	{
+		char        m_param[TIMER_SMALL_PARAM];
+		void*       m_large_param;
+	};
 };
 
-struct Watcher
+// Deadlines are in nanoseconds, nanosecond timers with less slack than this get a precise wait
+#define TIMER_PRECISE_SLACK 1000000
+
+// The deadline is kept in the heap, so sifting never touches the timers themselves
+struct TimerHeapEntry
 {
+	uint64_t      m_deadline;
 	struct Timer* m_timer;
+};
+
+#define TIMER_CHUNK 256
+
+struct TimerChunk
+{
+	struct TimerChunk* m_next;
+	struct Timer       m_timers[TIMER_CHUNK];
+};
+
+enum OpType
+{
+	OP_RECV,
+	OP_SEND,
+	OP_ACCEPT,
+	OP_CONNECT,
+	OP_RECV_BUFFER,
+	OP_SENDV,
+	OP_RECV_DATAGRAMS,
+	OP_SEND_DATAGRAMS,
+	OP_SENDFILE,
+
+	// Regular files, which are never queued on a watcher
+	OP_READ_FILE,
+	OP_WRITE_FILE,
+	OP_FSYNC_FILE
+};
+
+// The most iovecs gathered into one sendmsg()
+#define SENDV_IOV_MAX 64
+
+// The most one sendfile() call is asked for, it stops sooner once the socket is full anyway
+#define SENDFILE_CHUNK (1 << 20)
+
+struct SendFile
+{
+	int      m_file;
+	uint64_t m_offset;
+};
+
+// Fixed size receive buffers, only taken by a recv once there is data for it
+struct BufferPool
+{
+	struct Proactor* m_proactor;
+	unsigned char*   m_base;
+	size_t           m_size;
+	unsigned int     m_count;
+	unsigned int     m_group;  // The io_uring buffer group
+
+	// Without io_uring the proactor hands out the buffers itself
+	unsigned int*    m_free;
+	unsigned int     m_free_count;
+};
+
+// A completion based operation, queued on the watcher for its fd and direction
+struct Op
+{
+	struct Op*   m_next;
+	struct Proactor* m_proactor;
+	unsigned int m_type;
+	unsigned int m_started;
+	socket_t     m_fd;
+	void*        m_buf;
+	size_t       m_len;
+	size_t       m_sent;    // Sendv, m_buf and m_len are the iovecs still to send, or datagrams or file bytes sent
+	void*        m_gather;  // The sendmsg() in flight on io_uring, for the head of a queue
+	uint64_t     m_offset;  // File operations
+	task_t       m_parent;
+	task_fn_t    m_fn;
+	unsigned int m_param_len;
+
+	// A struct proactor_completion then the caller's param, handed to m_fn as it is
+	_Alignas(struct proactor_completion) unsigned char m_param[TASK_PARAM_MAX];
+};
+
+// A watcher with neither is one-shot: it runs once and is disarmed
+#define WATCHER_PERSISTENT 1
+#define WATCHER_EDGE       2
+
+// Which size the watcher was allocated with
+#define WATCHER_LARGE      4
+
+// Watchers only exist while armed, or while io_uring operations are queued on them
+// Most params are a pointer or two, and a watcher with a small one fits in a cache line
+struct Watcher
+{
+	union
+	{
+		struct Timer*   m_timer;
+		struct Watcher* m_next_free;
+	};
 	task_t        m_parent;
 	task_fn_t     m_fn;
+
+	// Operations waiting on this fd, run instead of m_fn
+	struct Op*    m_ops;
+	struct Op*    m_ops_tail;
+
+	unsigned int  m_mode;
 	unsigned int  m_param_len;
-	char          m_param[TASK_PARAM_MAX];
+	char          m_param[];
+};
+
+#define WATCHER_SMALL_PARAM 16
+#define WATCHER_CHUNK 256
+
+struct WatcherChunk
+{
+	struct WatcherChunk* m_next;
+};
+
+#if defined(PROACTOR_EPOLL)
+// Indexed directly by fd, so kept small: an idle fd costs just this
+struct FdEntry
+{
+	uint32_t        m_events;
+	uint32_t        m_registered;
+	uint32_t        m_armed;  // What the kernel was last given
+	struct Watcher* m_watchers[2];
+};
+#endif
+
+#define CONTROL_MSG_SIZE 256
+#define CONTROL_RING_SIZE 4096
+#define CONTROL_BATCH 16
+
+#define FILE_THREADS 4
+#define FILE_QUEUE 256
+
+// Batched dispatch: a callback to run, copied so the watcher or timer can change before it does
+struct Dispatch
+{
+	_Alignas(16) char m_param[TASK_PARAM_MAX];
+	task_t          m_parent;
+	task_fn_t       m_fn;
+	unsigned int    m_param_len;
+};
+
+// Everything ready since the last batch was taken, freed by whichever of the splitters and the proactor lets go last
+struct DispatchBatch
+{
+	atomic_size_t   m_pending;
+	atomic_int      m_taken;
+	size_t          m_count;
+	size_t          m_alloc_size;
+	struct Dispatch m_entries[];
+};
+
+// A splitter runs its events itself once its range is this small
+#define DISPATCH_GRAIN 4
+#define DISPATCH_CHUNK 64
+
+// Past this many events waiting on a busy batch, each goes straight to task_run() instead
+#define DISPATCH_MAX 4096
+
+// Admission control: over the high-water mark, new recv watchers and operations wait here rather than being armed
+struct HeldCommand
+{
+	struct HeldCommand* m_next;
+	socket_t            m_fd;
+	_Alignas(16) unsigned char m_msg[];
+};
+
+// Instrumentation, see proactor_enable_stats()
+// HDR style buckets, 16 to each power of two, so a value is recorded to within 1/16th of itself
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_BUCKETS ((65 - HISTOGRAM_SUB_BITS) << HISTOGRAM_SUB_BITS)
+
+struct StatsHistogram
+{
+	atomic_uint_fast64_t m_sum;
+	atomic_uint_fast64_t m_min;
+	atomic_uint_fast64_t m_max;
+	atomic_uint_fast64_t m_buckets[HISTOGRAM_BUCKETS];
+};
+
+// Shared by the proactor and the callbacks being timed, freed by whichever lets go last
+struct ProactorStats
+{
+	atomic_size_t        m_refs;
+	atomic_size_t        m_timers;
+	atomic_size_t        m_watchers;
+	struct StatsHistogram m_loop_ns;
+	struct StatsHistogram m_wait_ns;
+	struct StatsHistogram m_ready_fds;
+	struct StatsHistogram m_commands_per_read;
+	struct StatsHistogram m_timer_late_ns;
+	struct StatsHistogram m_dispatch_ns;
+};
+
+// A callback on its way to a task, with when it was ready
+struct StatsCall
+{
+	uint64_t              m_ready;
+	struct ProactorStats* m_stats;
+	task_fn_t             m_fn;
+	_Alignas(16) unsigned char m_param[TASK_PARAM_MAX - 32];
 };
 
 struct Proactor
 {
 	task_t          m_task;
+	scheduler_t     m_scheduler;
+	int             m_stopping;
+#if defined(PROACTOR_EPOLL)
+	int             m_epoll_fd;
+	int             m_timer_fd;
+	uint64_t        m_timer_fd_deadline;
+	struct FdEntry* m_fds;
+	size_t          m_fd_alloc_size;
+	struct epoll_event m_events[EPOLL_BATCH];
+#if defined(PROACTOR_URING)
+	struct Uring    m_uring;
+#endif
+#else
 	struct pollfd*  m_poll_fds;
-	struct Watcher* m_watchers;
+	struct Watcher** m_watchers;
 	size_t          m_poll_alloc_size;
-	struct Timer*   m_timers;
+	nfds_t          m_n_poll_fds;
+#endif
+	struct TimerHeapEntry* m_timer_heap;
 	size_t          m_timer_count;
 	size_t          m_timer_alloc_size;
-	nfds_t          m_n_poll_fds;
-	unsigned int    m_control_offset;
-	unsigned char   m_control_buf[1024];
-
+	struct Timer**  m_timer_hash;
+	size_t          m_timer_hash_mask;
+	struct Timer*   m_free_timers;
+	struct TimerChunk* m_timer_chunks;
+	struct Watcher* m_free_watchers[2];
+	struct WatcherChunk* m_watcher_chunks;
+	unsigned int    m_next_buffer_group;
+
+	// Sends from the current batch of commands, held back so each socket's can go in one syscall
+	struct Op*      m_sends[CONTROL_BATCH];
+	size_t          m_send_count;
+
+#if !defined(_WIN32)
+	// Blocking file i/o threads for when there is no io_uring, started on first use
+	struct Ring     m_file_jobs;
+	sema_t          m_file_sema;
+	thrd_t          m_file_threads[FILE_THREADS];
+	unsigned int    m_file_thread_count;
+
+	// File operations beyond FILE_QUEUE wait here, so they can't swamp the ring or the threads
+	unsigned int    m_file_inflight;
+	struct Op*      m_file_backlog;
+	struct Op*      m_file_backlog_tail;
+#endif
+	atomic_int      m_batch_dispatch;
+	struct DispatchBatch* m_batch;
+	struct DispatchBatch* m_dispatched;  // The last batch handed out, until a splitter has taken it
+	int             m_running;
+
+	// Callbacks that found the task pool full, run before anything newer once there is room
+	struct DispatchBatch* m_overflow;
+
+	// Admission control, see proactor_set_watermarks()
+	atomic_size_t   m_high_water;
+	atomic_size_t   m_low_water;
+	int             m_overloaded;
+	struct HeldCommand* m_held;
+	struct HeldCommand* m_held_tail;
+	atomic_size_t   m_queue_depth;
+	atomic_uint_fast64_t m_overloads;
+	atomic_uint_fast64_t m_shed;
+	atomic_uint_fast64_t m_deferred;
+
+	// Busy polling, see proactor_set_busy_poll()
+	atomic_uint_fast64_t m_busy_poll_ns;
+	atomic_uint     m_busy_poll_flags;
+	uint64_t        m_busy_until;
+	struct DispatchBatch* m_inline;      // Callbacks to run on the loop once it is between events
+
+	// Instrumentation, m_stats is NULL while it is off and m_stats_alloc is kept to carry on from if it is turned on again
+	_Atomic(struct ProactorStats*) m_stats;
+	_Atomic(struct ProactorStats*) m_stats_alloc;
+	struct ProactorStats* m_turn_stats;  // m_stats as this turn of the loop found it
+	uint64_t        m_waited;
+	size_t          m_watcher_count;
+
+	// Commands are written straight into the ring, the fds are only used to wake the proactor
+	struct Ring     m_commands;
+	atomic_int      m_sleeping;
 	socket_t        m_control_fd;
+	socket_t        m_control_recv_fd;
 	atomic_uint     m_next_timer_id;
 };
 
@@ -90,9 +419,19 @@ enum ProactorCommands
 	CMD_ADD_RECV_WATCHER,
 	CMD_ADD_RECV_T_WATCHER,
 	CMD_CANCEL_RECV_WATCHER,
+	CMD_ADD_RECV_P_WATCHER,
 	CMD_ADD_SEND_WATCHER,
 	CMD_ADD_SEND_T_WATCHER,
+	CMD_ADD_SEND_P_WATCHER,
 	CMD_CANCEL_SEND_WATCHER,
+
+	CMD_ADD_OP,
+	CMD_ADD_BUFFERS,
+	CMD_RETURN_BUFFER,
+	CMD_REMOVE_BUFFERS,
+	CMD_FILE_DONE,
+
+	CMD_EXIT,
 };
 
 static uint64_t timeNow()
@@ -100,86 +439,294 @@ static uint64_t timeNow()
 #if defined(_WIN32)
 	ULONGLONG ulTime;
 	QueryUnbiasedInterruptTime(&ulTime); // 100ns intervals, 1e7 per second
-	return ulTime / 10000;
+	return ulTime * 100;
 #else
 	struct timespec t = {1,0};
 	clock_gettime(CLOCK_MONOTONIC,&t);
-	return (uint64_t)t.tv_sec * 1000 +  t.tv_nsec / 1000000;
+	return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
 #endif
 }
 
-static struct Timer* proactorInsertTimer(struct Proactor* pr, uint64_t deadline)
+static size_t histogramIndex(uint64_t v)
+{
+	// The largest shift leaving the top HISTOGRAM_SUB_BITS + 1 bits
+	unsigned int shift = 0;
+	for (unsigned int step = 32; step; step >>= 1)
+	{
+		if ((v >> (shift + step)) >= (1 << HISTOGRAM_SUB_BITS))
+			shift += step;
+	}
+	return ((size_t)shift << HISTOGRAM_SUB_BITS) + (size_t)(v >> shift);
+}
+
+// The highest value that falls in bucket i
+static uint64_t histogramValue(size_t i)
+{
+	if (i < (2 << HISTOGRAM_SUB_BITS))
+		return i;
+
+	unsigned int shift = (unsigned int)(i >> HISTOGRAM_SUB_BITS) - 1;
+	uint64_t lower = (uint64_t)(i - ((size_t)shift << HISTOGRAM_SUB_BITS)) << shift;
+	return lower + ((UINT64_C(1) << shift) - 1);
+}
+
+static void statsRecord(struct StatsHistogram* h, uint64_t v)
+{
+	atomic_fetch_add_explicit(&h->m_buckets[histogramIndex(v)],1,memory_order_relaxed);
+	atomic_fetch_add_explicit(&h->m_sum,v,memory_order_relaxed);
+
+	uint64_t m = atomic_load_explicit(&h->m_min,memory_order_relaxed);
+	while (v < m && !atomic_compare_exchange_weak_explicit(&h->m_min,&m,v,memory_order_relaxed,memory_order_relaxed))
+		;
+
+	m = atomic_load_explicit(&h->m_max,memory_order_relaxed);
+	while (v > m && !atomic_compare_exchange_weak_explicit(&h->m_max,&m,v,memory_order_relaxed,memory_order_relaxed))
+		;
+}
+
+static void statsRelease(struct ProactorStats* s)
+{
+	if (atomic_fetch_sub_explicit(&s->m_refs,1,memory_order_acq_rel) == 1)
+		free(s);
+}
+
+static void proactorStatsCall(task_t task, void* param)
+{
+	struct StatsCall* sc = param;
+	statsRecord(&sc->m_stats->m_dispatch_ns,timeNow() - sc->m_ready);
+	(*sc->m_fn)(task,sc->m_param);
+	statsRelease(sc->m_stats);
+}
+
+// With stats on, fn goes by way of proactorStatsCall() in sc, to time it from now until it starts
+// A param that doesn't leave room for the timestamp goes as it is, unmeasured
+static task_fn_t proactorStatsWrap(struct Proactor* pr, task_fn_t fn, const void** param, unsigned int* param_len, struct StatsCall* sc)
 {
-	size_t start = 0;
-	for (size_t end = pr->m_timer_count;start < end;)
+	struct ProactorStats* s = pr->m_turn_stats;
+	if (!s || *param_len > sizeof(sc->m_param))
+		return fn;
+
+	sc->m_ready = timeNow();
+	sc->m_stats = s;
+	sc->m_fn = fn;
+	if (*param_len)
+		memcpy(sc->m_param,*param,*param_len);
+	atomic_fetch_add_explicit(&s->m_refs,1,memory_order_relaxed);
+
+	*param = sc;
+	*param_len += offsetof(struct StatsCall,m_param);
+	return &proactorStatsCall;
+}
+
+static struct Timer* proactorAllocTimer(struct Proactor* pr)
+{
+	if (!pr->m_free_timers)
 	{
-		while (start < end && pr->m_timers[start].m_deadline == 0)
-			++start;
+		// Timers never move once allocated, so watchers can point at them
+		struct TimerChunk* chunk = malloc(sizeof(struct TimerChunk));
+		if (!chunk)
+			abort();
 
-		while (start < end && pr->m_timers[end].m_deadline == 0)
-			--end;
+		chunk->m_next = pr->m_timer_chunks;
+		pr->m_timer_chunks = chunk;
 
-		size_t mid = start + (end - start) / 2;
-		while (start < mid && pr->m_timers[mid].m_deadline == 0)
-			--mid;
+		for (size_t i = 0; i < TIMER_CHUNK; ++i)
+		{
+			chunk->m_timers[i].m_next_free = pr->m_free_timers;
+			pr->m_free_timers = &chunk->m_timers[i];
+		}
+	}
 
-		if (pr->m_timers[mid].m_deadline > deadline)
-			start = mid + 1;
-		else
-			end = mid;
+	struct Timer* t = pr->m_free_timers;
+	pr->m_free_timers = t->m_next_free;
+	return t;
+}
+
+static void* timerParam(struct Timer* t)
+{
+	return t->m_param_len > TIMER_SMALL_PARAM ? t->m_large_param : t->m_param;
+}
+
+static void proactorFreeTimer(struct Proactor* pr, struct Timer* t)
+{
+	if (t->m_param_len > TIMER_SMALL_PARAM)
+		free(t->m_large_param);
+
+	t->m_next_free = pr->m_free_timers;
+	pr->m_free_timers = t;
+}
+
+static size_t timerHash(unsigned int id)
+{
+	return (size_t)id * UINT32_C(2654435761);
+}
+
+static struct Timer* proactorFindTimer(struct Proactor* pr, unsigned int id)
+{
+	if (!pr->m_timer_hash)
+		return NULL;
+
+	for (size_t i = timerHash(id) & pr->m_timer_hash_mask; pr->m_timer_hash[i]; i = (i + 1) & pr->m_timer_hash_mask)
+	{
+		if (pr->m_timer_hash[i]->m_id == id)
+			return pr->m_timer_hash[i];
 	}
+	return NULL;
+}
 
-	// Insert at 'start'
-	if (start == pr->m_timer_count || pr->m_timers[start].m_deadline != 0)
+static void proactorHashTimer(struct Proactor* pr, struct Timer* t)
+{
+	// Keep the load factor under a half
+	if ((pr->m_timer_count + 1) * 2 > pr->m_timer_hash_mask + 1)
 	{
-		// Find the next gap
-		size_t gap = start + 1;
-		while (gap < pr->m_timer_count && pr->m_timers[gap].m_deadline == 0)
-			++gap;
+		size_t old_size = pr->m_timer_hash ? pr->m_timer_hash_mask + 1 : 0;
+		size_t new_size = old_size ? old_size * 2 : 64;
+		struct Timer** new_hash = calloc(new_size,sizeof(struct Timer*));
+		if (!new_hash)
+			abort();
 
-		if (gap >= pr->m_timer_count)
+		for (size_t i = 0; i < old_size; ++i)
 		{
-			// Need to grow
-			if (gap >= pr->m_timer_alloc_size)
+			if (pr->m_timer_hash[i])
 			{
-				// Need to realloc
-				size_t new_size = pr->m_timer_alloc_size * 2;
-				struct Timer* new_timers = realloc(pr->m_timers,new_size);
-				if (!new_timers)
-					abort();
-
-				pr->m_timers = new_timers;
-				pr->m_timer_alloc_size = new_size;
+				size_t j = timerHash(pr->m_timer_hash[i]->m_id) & (new_size - 1);
+				while (new_hash[j])
+					j = (j + 1) & (new_size - 1);
+				new_hash[j] = pr->m_timer_hash[i];
 			}
-			gap = pr->m_timer_count++;
 		}
 
-		// Shuffle down
-		while (gap > start)
+		free(pr->m_timer_hash);
+		pr->m_timer_hash = new_hash;
+		pr->m_timer_hash_mask = new_size - 1;
+	}
+
+	size_t i = timerHash(t->m_id) & pr->m_timer_hash_mask;
+	while (pr->m_timer_hash[i])
+		i = (i + 1) & pr->m_timer_hash_mask;
+	pr->m_timer_hash[i] = t;
+}
+
+static void proactorUnhashTimer(struct Proactor* pr, struct Timer* t)
+{
+	size_t i = timerHash(t->m_id) & pr->m_timer_hash_mask;
+	while (pr->m_timer_hash[i] != t)
+		i = (i + 1) & pr->m_timer_hash_mask;
+
+	// Backward shift deletion, so lookups never need tombstones
+	for (size_t j = i;;)
+	{
+		j = (j + 1) & pr->m_timer_hash_mask;
+		if (!pr->m_timer_hash[j])
+			break;
+
+		// Move j into the hole at i, unless its home slot is cyclically in (i,j]
+		size_t k = timerHash(pr->m_timer_hash[j]->m_id) & pr->m_timer_hash_mask;
+		if (i <= j ? (k <= i || k > j) : (k <= i && k > j))
 		{
-			pr->m_timers[gap] = pr->m_timers[gap-1];
-			--gap;
+			pr->m_timer_hash[i] = pr->m_timer_hash[j];
+			i = j;
+		}
+	}
+	pr->m_timer_hash[i] = NULL;
+}
+
+static void proactorHeapSet(struct Proactor* pr, size_t i, struct TimerHeapEntry e)
+{
+	pr->m_timer_heap[i] = e;
+	e.m_timer->m_heap_index = i;
+}
+
+// A 4-ary heap is shallower than a binary heap, and the children share a cache line
+static void proactorSiftUp(struct Proactor* pr, size_t i)
+{
+	struct TimerHeapEntry e = pr->m_timer_heap[i];
+	while (i > 0)
+	{
+		size_t parent = (i - 1) / 4;
+		if (pr->m_timer_heap[parent].m_deadline <= e.m_deadline)
+			break;
+
+		proactorHeapSet(pr,i,pr->m_timer_heap[parent]);
+		i = parent;
+	}
+	proactorHeapSet(pr,i,e);
+}
+
+static void proactorSiftDown(struct Proactor* pr, size_t i)
+{
+	struct TimerHeapEntry e = pr->m_timer_heap[i];
+	for (;;)
+	{
+		size_t child = i * 4 + 1;
+		if (child >= pr->m_timer_count)
+			break;
 
-			// Fix up watcher
-			if (pr->m_timers[gap].m_watcher)
-				pr->m_timers[gap].m_watcher->m_timer = &pr->m_timers[gap];
+		size_t end = child + 4 < pr->m_timer_count ? child + 4 : pr->m_timer_count;
+		size_t min = child;
+		for (size_t c = child + 1; c < end; ++c)
+		{
+			if (pr->m_timer_heap[c].m_deadline < pr->m_timer_heap[min].m_deadline)
+				min = c;
 		}
+
+		if (pr->m_timer_heap[min].m_deadline >= e.m_deadline)
+			break;
+
+		proactorHeapSet(pr,i,pr->m_timer_heap[min]);
+		i = min;
+	}
+	proactorHeapSet(pr,i,e);
+}
+
+static void proactorInsertTimer(struct Proactor* pr, struct Timer* t, uint64_t deadline)
+{
+	proactorHashTimer(pr,t);
+
+	if (pr->m_timer_count == pr->m_timer_alloc_size)
+	{
+		size_t new_size = pr->m_timer_alloc_size ? pr->m_timer_alloc_size * 2 : 64;
+		struct TimerHeapEntry* new_heap = realloc(pr->m_timer_heap,new_size * sizeof(struct TimerHeapEntry));
+		if (!new_heap)
+			abort();
+
+		pr->m_timer_heap = new_heap;
+		pr->m_timer_alloc_size = new_size;
 	}
-	pr->m_timers[start].m_deadline = deadline;
-	return &pr->m_timers[start];
+
+	size_t i = pr->m_timer_count++;
+	pr->m_timer_heap[i].m_deadline = deadline;
+	pr->m_timer_heap[i].m_timer = t;
+	proactorSiftUp(pr,i);
+}
+
+static void proactorRescheduleTimer(struct Proactor* pr, struct Timer* t, uint64_t deadline)
+{
+	size_t i = t->m_heap_index;
+	uint64_t old_deadline = pr->m_timer_heap[i].m_deadline;
+	pr->m_timer_heap[i].m_deadline = deadline;
+	if (deadline < old_deadline)
+		proactorSiftUp(pr,i);
+	else
+		proactorSiftDown(pr,i);
 }
 
-static void proactorReorderTimer(struct Proactor* pr, struct Timer* t)
+static void proactorRemoveTimer(struct Proactor* pr, struct Timer* t)
 {
-	if (t > pr->m_timers && (t-1)->m_deadline < t->m_deadline)
+	proactorUnhashTimer(pr,t);
+
+	size_t i = t->m_heap_index;
+	if (i < --pr->m_timer_count)
 	{
-		struct Timer t_old = *t;
-		t->m_deadline = 0;
-		struct Timer* t_new = proactorInsertTimer(pr,t_old.m_deadline);
-		*t_new = t_old;
-		if (t_new->m_watcher)
-			t_new->m_watcher->m_timer = t_new;
+		uint64_t old_deadline = pr->m_timer_heap[i].m_deadline;
+		proactorHeapSet(pr,i,pr->m_timer_heap[pr->m_timer_count]);
+		if (pr->m_timer_heap[i].m_deadline < old_deadline)
+			proactorSiftUp(pr,i);
+		else
+			proactorSiftDown(pr,i);
 	}
+
+	proactorFreeTimer(pr,t);
 }
 
 #define READ_ARG(D,P) \
@@ -194,40 +741,105 @@ static void proactorReorderTimer(struct Proactor* pr, struct Timer* t)
 		P += sizeof(S); \
 	} while (0)
 
-static void proactorWriteControl(struct Proactor* pr, const unsigned char* msg)
+static void proactorWake(struct Proactor* pr)
 {
 #if defined(_WIN32)
-	int w = send(pr->m_control_fd,(void*)msg,msg[1],0);
+	char c = 0;
+	int w = send(pr->m_control_fd,&c,1,0);
+	if (w == -1 && WSAGetLastError() == WSAEWOULDBLOCK)
+		w = 1;
 #else
+	// An eventfd wants 8 bytes, a pipe is happy with them too
+	uint64_t v = 1;
 	ssize_t w;
 	do
-	{
-		w = send(pr->m_control_fd,msg,msg[1],0);
-	}
+		w = write(pr->m_control_fd,&v,sizeof(v));
 	while (w == -1 && errno == EINTR);
+
+	// A full pipe will wake the proactor anyway
+	if (w == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		w = 1;
 #endif
-	if (w != msg[1])
+	if (w <= 0)
 		abort();
 }
 
+// The proactor whose inline callbacks this thread is running, if any
+static _Thread_local struct Proactor* s_inline_proactor;
+
+static void proactorReadControl(struct Proactor* pr);
+
+static void proactorWriteControl(struct Proactor* pr, const unsigned char* msg)
+{
+	_Alignas(16) unsigned char cell[CONTROL_MSG_SIZE];
+	memcpy(cell,msg,msg[1]);
+
+	while (!ringSend(&pr->m_commands,cell,1))
+	{
+		// An inline callback would be waiting on itself, so make the room here, the loop is between events
+		if (s_inline_proactor == pr)
+		{
+			proactorReadControl(pr);
+			continue;
+		}
+
+		// The proactor is behind, make sure it is awake and let it catch up
+		if (atomic_exchange(&pr->m_sleeping,0))
+			proactorWake(pr);
+
+		thrd_yield();
+	}
+
+	// Only pay for the syscall if the proactor is blocked in poll
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&pr->m_sleeping,memory_order_relaxed) && atomic_exchange(&pr->m_sleeping,0))
+		proactorWake(pr);
+}
+
+// Round the deadline up onto a grid no coarser than the slack, so timers with similar slack
+// land on the same instant and expire together in one wakeup
+static uint64_t timerCoalesce(uint64_t deadline, uint64_t slack)
+{
+	if (slack < 2)
+		return deadline;
+
+	uint64_t grain = 1;
+	while (grain * 2 <= slack)
+		grain *= 2;
+
+	return (deadline + grain - 1) & ~(grain - 1);
+}
+
 static struct Timer* proactorAddTimer(struct Proactor* pr, unsigned char* p)
 {
 	uint64_t deadline;
 	READ_ARG(deadline,p);
 
-	struct Timer* t = proactorInsertTimer(pr,deadline);
-	t->m_watcher = NULL;
+	struct Timer* t = proactorAllocTimer(pr);
+	t->m_fd = 0;
+	t->m_flags = 0;
 	READ_ARG(t->m_fn,p);
 	READ_ARG(t->m_id,p);
 	READ_ARG(t->m_parent,p);
 	READ_ARG(t->m_repeat,p);
+	READ_ARG(t->m_slack,p);
+	READ_ARG(t->m_precise,p);
 	READ_ARG(t->m_param_len,p);
+	if (t->m_param_len > TIMER_SMALL_PARAM)
+	{
+		t->m_large_param = malloc(t->m_param_len);
+		if (!t->m_large_param)
+			abort();
+	}
 	if (t->m_param_len)
-		memcpy(t->m_param,p,t->m_param_len);
+		memcpy(timerParam(t),p,t->m_param_len);
+
+	proactorInsertTimer(pr,t,timerCoalesce(deadline,t->m_slack));
 	return t;
 }
 
-static unsigned char* proactorSendAddTimer(struct Proactor* pr, unsigned char* p, unsigned int id, uint32_t timeout, uint32_t repeat, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+// Millisecond timers never ask for a precise wait, the poll timeout rounded up to the next millisecond is close enough
+static unsigned char* proactorSendAddTimer(struct Proactor* pr, unsigned char* p, unsigned int id, uint64_t timeout, uint64_t repeat, uint64_t slack, int precise, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
 {
 	uint64_t deadline = timeNow() + timeout;
 	WRITE_ARG(deadline,p);
@@ -235,6 +847,8 @@ static unsigned char* proactorSendAddTimer(struct Proactor* pr, unsigned char* p
 	WRITE_ARG(id,p);
 	WRITE_ARG(pt,p);
 	WRITE_ARG(repeat,p);
+	WRITE_ARG(slack,p);
+	WRITE_ARG(precise,p);
 	WRITE_ARG(param_len,p);
 	if (param_len)
 	{
@@ -245,7 +859,7 @@ static unsigned char* proactorSendAddTimer(struct Proactor* pr, unsigned char* p
 	return p;
 }
 
-unsigned int proactor_add_timer(proactor_t ph, uint32_t timeout, uint32_t repeat, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+static unsigned int proactorSendTimer(proactor_t ph, uint64_t timeout_ns, uint64_t repeat_ns, uint64_t slack_ns, int precise, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
 {
 	struct Proactor* pr = (struct Proactor*)ph;
 
@@ -253,10 +867,10 @@ unsigned int proactor_add_timer(proactor_t ph, uint32_t timeout, uint32_t repeat
 	while (id == 0)
 		id = atomic_fetch_add(&pr->m_next_timer_id,1);
 
-	unsigned char msg[sizeof(struct Timer) + 8] = { CMD_ADD_TIMER };
+	_Alignas(16) unsigned char msg[sizeof(struct Timer) + TASK_PARAM_MAX + 8] = { CMD_ADD_TIMER };
 	static_assert(sizeof(msg) < 256, "Message buffer size > 255");
 
-	unsigned char* p = proactorSendAddTimer(pr,msg + 2,id,timeout,repeat,pt,fn,param,param_len);
+	unsigned char* p = proactorSendAddTimer(pr,msg + 2,id,timeout_ns,repeat_ns,slack_ns,precise,pt,fn,param,param_len);
 
 	msg[1] = (p - msg);
 	assert(p - msg <= sizeof(msg));
@@ -264,27 +878,38 @@ unsigned int proactor_add_timer(proactor_t ph, uint32_t timeout, uint32_t repeat
 	return id;
 }
 
+unsigned int proactor_add_timer_ns(proactor_t ph, uint64_t timeout_ns, uint64_t repeat_ns, uint64_t slack_ns, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	return proactorSendTimer(ph,timeout_ns,repeat_ns,slack_ns,slack_ns < TIMER_PRECISE_SLACK,pt,fn,param,param_len);
+}
+
+unsigned int proactor_add_timer(proactor_t ph, uint32_t timeout, uint32_t repeat, uint32_t slack, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	return proactorSendTimer(ph,timeout * UINT64_C(1000000),repeat * UINT64_C(1000000),slack * UINT64_C(1000000),0,pt,fn,param,param_len);
+}
+
+static struct Watcher* proactorFindWatcher(struct Proactor* pr, socket_t fd, unsigned int flags);
+static void proactorRunTask(struct Proactor* pr, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+#if !defined(_WIN32)
+static void proactorFileDone(struct Proactor* pr);
+#endif
+
 static void proactorCancelTimer(struct Proactor* pr, unsigned char* p)
 {
 	unsigned int id;
 	READ_ARG(id,p);
 
-	for (size_t i = 0; i < pr->m_timer_count; ++i)
+	struct Timer* t = proactorFindTimer(pr,id);
+	if (t)
 	{
-		if (pr->m_timers[i].m_id == id)
+		if (t->m_flags)
 		{
-			if (pr->m_timers[i].m_deadline != 0)
-			{
-				if (pr->m_timers[i].m_watcher)
-					pr->m_timers[i].m_watcher->m_timer = NULL;
-
-				if (i == pr->m_timer_count - 1)
-					--pr->m_timer_count;
-				else
-					pr->m_timers[i].m_deadline = 0;
-			}
-			break;
+			// The watcher carries on, without a timeout
+			struct Watcher* w = proactorFindWatcher(pr,t->m_fd,t->m_flags);
+			if (w)
+				w->m_timer = NULL;
 		}
+		proactorRemoveTimer(pr,t);
 	}
 }
 
@@ -292,7 +917,7 @@ void proactor_cancel_timer(proactor_t ph, unsigned int timer_id)
 {
 	struct Proactor* pr = (struct Proactor*)ph;
 
-	unsigned char msg[16] = { CMD_CANCEL_TIMER };
+	_Alignas(16) unsigned char msg[16] = { CMD_CANCEL_TIMER };
 	unsigned char* p = msg + 2;
 
 	WRITE_ARG(timer_id,p);
@@ -307,53 +932,219 @@ static void proactorUpdateTimer(struct Proactor* pr, unsigned char* p)
 	unsigned int id;
 	READ_ARG(id,p);
 
-	for (size_t i = 0; i < pr->m_timer_count; ++i)
+	struct Timer* t = proactorFindTimer(pr,id);
+	if (t)
 	{
-		if (pr->m_timers[i].m_id == id)
-		{
-			if (pr->m_timers[i].m_deadline != 0)
-			{
-				READ_ARG(pr->m_timers[i].m_deadline,p);
-				READ_ARG(pr->m_timers[i].m_repeat,p);
+		uint64_t deadline;
+		READ_ARG(deadline,p);
+		READ_ARG(t->m_repeat,p);
 
-				pr->m_timers[i].m_deadline = timeNow() + pr->m_timers[i].m_repeat;
-				proactorReorderTimer(pr,&pr->m_timers[i]);
-			}
-			break;
-		}
+		proactorRescheduleTimer(pr,t,timerCoalesce(deadline,t->m_slack));
 	}
 }
 
-void proactor_update_timer(proactor_t ph, unsigned int timer_id, uint32_t timeout, uint32_t repeat)
+void proactor_update_timer_ns(proactor_t ph, unsigned int timer_id, uint64_t timeout_ns, uint64_t repeat_ns)
 {
 	struct Proactor* pr = (struct Proactor*)ph;
 
-	unsigned char msg[32] = { CMD_UPDATE_TIMER };
+	_Alignas(16) unsigned char msg[32] = { CMD_UPDATE_TIMER };
 	unsigned char* p = msg + 2;
 
 	WRITE_ARG(timer_id,p);
-	uint64_t deadline = timeNow() + timeout;
+	uint64_t deadline = timeNow() + timeout_ns;
 	WRITE_ARG(deadline,p);
-	WRITE_ARG(repeat,p);
+	WRITE_ARG(repeat_ns,p);
 
 	msg[1] = (p - msg);
 	assert(p - msg <= sizeof(msg));
 	proactorWriteControl(pr,msg);
 }
 
-static struct Watcher* proactorAddWatcher(struct Proactor* pr, unsigned char** p, unsigned int flags)
+void proactor_update_timer(proactor_t ph, unsigned int timer_id, uint32_t timeout, uint32_t repeat)
 {
-	socket_t fd;
-	READ_ARG(fd,p);
+	proactor_update_timer_ns(ph,timer_id,timeout * UINT64_C(1000000),repeat * UINT64_C(1000000));
+}
 
-	size_t i = 1;
-	for (; i < pr->m_n_poll_fds; ++i)
+static struct Watcher* proactorAllocWatcher(struct Proactor* pr, unsigned int param_len)
+{
+	unsigned int large = (param_len > WATCHER_SMALL_PARAM);
+	size_t size = sizeof(struct Watcher) + (large ? TASK_PARAM_MAX : WATCHER_SMALL_PARAM);
+	if (!pr->m_free_watchers[large])
 	{
-		if (pr->m_poll_fds[i].fd == fd)
-			break;
+		// Watchers never move once allocated
+		struct WatcherChunk* chunk = malloc(sizeof(struct WatcherChunk) + WATCHER_CHUNK * size);
+		if (!chunk)
+			abort();
+
+		chunk->m_next = pr->m_watcher_chunks;
+		pr->m_watcher_chunks = chunk;
+
+		for (size_t i = 0; i < WATCHER_CHUNK; ++i)
+		{
+			struct Watcher* w = (struct Watcher*)((unsigned char*)(chunk + 1) + i * size);
+			w->m_next_free = pr->m_free_watchers[large];
+			pr->m_free_watchers[large] = w;
+		}
 	}
 
-	if (i == pr->m_n_poll_fds)
+	struct Watcher* w = pr->m_free_watchers[large];
+	pr->m_free_watchers[large] = w->m_next_free;
+
+	w->m_timer = NULL;
+	w->m_ops = w->m_ops_tail = NULL;
+	w->m_mode = large ? WATCHER_LARGE : 0;
+	w->m_param_len = 0;
+	++pr->m_watcher_count;
+	return w;
+}
+
+// Frees the watchers for flags, which are no longer armed, unless operations are still queued on them
+static void proactorReleaseWatchers(struct Proactor* pr, struct Watcher** watchers, unsigned int flags)
+{
+	for (unsigned int i = 0; i < 2; ++i)
+	{
+		struct Watcher* w = watchers[i];
+		if (w && !w->m_ops && (flags & (i ? POLL_EVENT_WR : POLL_EVENT_RD)))
+		{
+			w->m_next_free = pr->m_free_watchers[(w->m_mode & WATCHER_LARGE) ? 1 : 0];
+			pr->m_free_watchers[(w->m_mode & WATCHER_LARGE) ? 1 : 0] = w;
+			watchers[i] = NULL;
+			--pr->m_watcher_count;
+		}
+	}
+}
+
+// SO_BUSY_POLL has the kernel spin on the device queue for a socket that has nothing to read
+// Going above net.core.busy_read needs CAP_NET_ADMIN, and not every fd is a socket, so failure is ignored
+static void proactorBusyPollSocket(struct Proactor* pr, socket_t fd)
+{
+#if defined(SO_BUSY_POLL)
+	if (atomic_load_explicit(&pr->m_busy_poll_flags,memory_order_relaxed) & PROACTOR_BUSY_POLL_SOCKETS)
+	{
+		int usecs = (int)(atomic_load_explicit(&pr->m_busy_poll_ns,memory_order_relaxed) / 1000);
+		setsockopt(fd,SOL_SOCKET,SO_BUSY_POLL,&usecs,sizeof(usecs));
+	}
+#endif
+}
+
+#if defined(PROACTOR_EPOLL)
+static struct FdEntry* proactorFdEntry(struct Proactor* pr, socket_t fd)
+{
+	if ((size_t)fd >= pr->m_fd_alloc_size)
+	{
+		size_t new_size = pr->m_fd_alloc_size * 2;
+		while (new_size <= (size_t)fd)
+			new_size *= 2;
+
+		struct FdEntry* new_fds = realloc(pr->m_fds,new_size * sizeof(struct FdEntry));
+		if (!new_fds)
+			abort();
+		memset(new_fds + pr->m_fd_alloc_size,0,(new_size - pr->m_fd_alloc_size) * sizeof(struct FdEntry));
+
+		pr->m_fds = new_fds;
+		pr->m_fd_alloc_size = new_size;
+	}
+	return &pr->m_fds[fd];
+}
+
+// One-shot watchers register the fd EPOLLONESHOT, so it only needs re-arming, never removing
+// If every armed watcher is persistent the registration is left alone between events
+static int proactorEpollArm(struct Proactor* pr, socket_t fd, struct FdEntry* e)
+{
+	unsigned int mode = e->m_events ? (WATCHER_PERSISTENT | WATCHER_EDGE) : 0;
+	if (e->m_events & POLL_EVENT_RD)
+		mode &= e->m_watchers[0]->m_mode;
+	if (e->m_events & POLL_EVENT_WR)
+		mode &= e->m_watchers[1]->m_mode;
+
+	struct epoll_event ev = { .events = e->m_events, .data.fd = fd };
+	if (!(mode & WATCHER_PERSISTENT))
+		ev.events |= EPOLLONESHOT;
+	else if (mode & WATCHER_EDGE)
+		ev.events |= EPOLLET;
+
+	if (e->m_registered && ev.events == e->m_armed && !(ev.events & EPOLLONESHOT))
+		return 0;
+
+	int op = e->m_registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	int err = epoll_ctl(pr->m_epoll_fd,op,fd,&ev);
+	if (err == -1)
+	{
+		// The fd may have been closed and the number reused since we last saw it
+		if (op == EPOLL_CTL_MOD && errno == ENOENT)
+			err = epoll_ctl(pr->m_epoll_fd,EPOLL_CTL_ADD,fd,&ev);
+		else if (op == EPOLL_CTL_ADD && errno == EEXIST)
+			err = epoll_ctl(pr->m_epoll_fd,EPOLL_CTL_MOD,fd,&ev);
+	}
+	if (!e->m_registered && err == 0)
+		proactorBusyPollSocket(pr,fd);
+	e->m_registered = (err == 0);
+	e->m_armed = ev.events;
+	return err;
+}
+
+// Returns the watcher for flags on fd, with room for param_len, or NULL if epoll refuses the fd, e.g. regular files,
+// which are always ready anyway, or if io_uring operations are queued in that direction
+static struct Watcher* proactorArm(struct Proactor* pr, socket_t fd, unsigned int flags, unsigned int mode, unsigned int param_len)
+{
+	struct FdEntry* e = proactorFdEntry(pr,fd);
+	assert(!(e->m_events & flags));
+
+	struct Watcher** w = &e->m_watchers[(flags & POLL_EVENT_WR) ? 1 : 0];
+	if (*w)
+	{
+		errno = EBUSY;
+		return NULL;
+	}
+
+	*w = proactorAllocWatcher(pr,param_len);
+	(*w)->m_mode |= mode;
+	e->m_events |= flags;
+
+	if (proactorEpollArm(pr,fd,e) != 0)
+	{
+		e->m_events &= ~flags;
+		proactorReleaseWatchers(pr,e->m_watchers,flags);
+		return NULL;
+	}
+	return *w;
+}
+
+// Returns the watcher for flags on fd, if it is armed
+static struct Watcher* proactorFindWatcher(struct Proactor* pr, socket_t fd, unsigned int flags)
+{
+	if ((size_t)fd >= pr->m_fd_alloc_size || !(pr->m_fds[fd].m_events & flags))
+		return NULL;
+
+	return pr->m_fds[fd].m_watchers[(flags & POLL_EVENT_WR) ? 1 : 0];
+}
+
+static void proactorDisarm(struct Proactor* pr, socket_t fd, unsigned int flags)
+{
+	struct FdEntry* e = &pr->m_fds[fd];
+	e->m_events &= ~flags;
+	proactorReleaseWatchers(pr,e->m_watchers,flags);
+
+	// Re-arming with no events disables the fd without another syscall to remove it
+	proactorEpollArm(pr,fd,e);
+}
+#else
+static size_t proactorFindFd(struct Proactor* pr, socket_t fd)
+{
+	size_t i = 1;
+	for (; i < pr->m_n_poll_fds; ++i)
+	{
+		if (pr->m_poll_fds[i].fd == fd)
+			break;
+	}
+	return i;
+}
+
+// poll() has no edge-triggering, so edge-triggered watchers are level-triggered here
+static struct Watcher* proactorArm(struct Proactor* pr, socket_t fd, unsigned int flags, unsigned int mode, unsigned int param_len)
+{
+	size_t i = proactorFindFd(pr,fd);
+	if (i == pr->m_n_poll_fds)
 	{
 		if (i == pr->m_poll_alloc_size)
 		{
@@ -364,32 +1155,89 @@ static struct Watcher* proactorAddWatcher(struct Proactor* pr, unsigned char** p
 				abort();
 			pr->m_poll_fds = new_poll_fds;
 
-			struct Watcher* new_watchers = realloc(pr->m_watchers,new_size * sizeof(struct Watcher) * 2);
+			struct Watcher** new_watchers = realloc(pr->m_watchers,new_size * sizeof(struct Watcher*) * 2);
 			if (!new_watchers)
 				abort();
 			pr->m_watchers = new_watchers;
 			pr->m_poll_alloc_size = new_size;
+			i = pr->m_n_poll_fds;
 		}
 
 		++pr->m_n_poll_fds;
 		pr->m_poll_fds[i].fd = fd;
 		pr->m_poll_fds[i].events = 0;
+		pr->m_watchers[i * 2] = pr->m_watchers[i * 2 + 1] = NULL;
+		proactorBusyPollSocket(pr,fd);
 	}
 
 	assert(!(pr->m_poll_fds[i].events & flags));
 	pr->m_poll_fds[i].events |= flags;
 
-	struct Watcher* w = &pr->m_watchers[i * 2];
-	if (flags & POLL_EVENT_WR)
-		++w;
+	struct Watcher* w = proactorAllocWatcher(pr,param_len);
+	w->m_mode |= mode;
+	pr->m_watchers[(flags & POLL_EVENT_WR) ? i * 2 + 1 : i * 2] = w;
+	return w;
+}
 
-	w->m_timer = NULL;
-	READ_ARG(w->m_parent,p);
-	READ_ARG(w->m_fn,p);
-	READ_ARG(w->m_param_len,p);
-	if (w->m_param_len)
-		memcpy(w->m_param,p,w->m_param_len);
+static struct Watcher* proactorFindWatcher(struct Proactor* pr, socket_t fd, unsigned int flags)
+{
+	size_t i = proactorFindFd(pr,fd);
+	if (i == pr->m_n_poll_fds || !(pr->m_poll_fds[i].events & flags))
+		return NULL;
+
+	return pr->m_watchers[(flags & POLL_EVENT_WR) ? i * 2 + 1 : i * 2];
+}
+
+static void proactorRemoveWatcher(struct Proactor* pr, size_t i)
+{
+	// Swap array member with last member
+	if (--pr->m_n_poll_fds > 1 && i < pr->m_n_poll_fds)
+	{
+		pr->m_poll_fds[i] = pr->m_poll_fds[pr->m_n_poll_fds];
+		pr->m_watchers[i*2] = pr->m_watchers[pr->m_n_poll_fds*2];
+		pr->m_watchers[i*2+1] = pr->m_watchers[pr->m_n_poll_fds*2+1];
+	}
+}
+
+static void proactorDisarm(struct Proactor* pr, socket_t fd, unsigned int flags)
+{
+	size_t i = proactorFindFd(pr,fd);
+	pr->m_poll_fds[i].events &= ~flags;
+	proactorReleaseWatchers(pr,&pr->m_watchers[i*2],flags);
+	if (!pr->m_poll_fds[i].events)
+		proactorRemoveWatcher(pr,i);
+}
+#endif
+
+// If the fd can't be watched fn is run straight away, as it would be for a regular file
+// Mixing watchers and operations on the same fd and direction is not supported
+static struct Watcher* proactorAddWatcher(struct Proactor* pr, unsigned char** p, unsigned int flags, unsigned int mode)
+{
+	socket_t fd;
+	task_t parent;
+	task_fn_t fn;
+	unsigned int param_len;
+	READ_ARG(fd,*p);
+	READ_ARG(parent,*p);
+	READ_ARG(fn,*p);
+	READ_ARG(param_len,*p);
+
+	struct Watcher* w = proactorArm(pr,fd,flags,mode,param_len);
+	if (!w)
+	{
+		proactorRunTask(pr,parent,fn,*p,param_len);
+		*p += param_len;
+		return NULL;
+	}
 
+	w->m_parent = parent;
+	w->m_fn = fn;
+	w->m_param_len = param_len;
+	if (param_len)
+		memcpy(w->m_param,*p,param_len);
+
+	// A timed watcher's timer follows
+	*p += param_len;
 	return w;
 }
 
@@ -412,7 +1260,7 @@ static void proactorSendSimpleAddWatcher(enum ProactorCommands op_code, proactor
 {
 	struct Proactor* pr = (struct Proactor*)ph;
 
-	unsigned char msg[sizeof(struct Watcher) + 8] = { op_code };
+	_Alignas(16) unsigned char msg[sizeof(struct Watcher) + TASK_PARAM_MAX + 8] = { op_code };
 	static_assert(sizeof(msg) < 256, "Message buffer size > 255");
 
 	unsigned char* p = proactorSendAddWatcher(pr,msg + 2,fd,pt,fn,param,param_len);
@@ -432,23 +1280,54 @@ void proactor_add_send_watcher(proactor_t ph, socket_t fd, task_t pt, task_fn_t
 	proactorSendSimpleAddWatcher(CMD_ADD_SEND_WATCHER,ph,fd,pt,fn,param,param_len);
 }
 
+static void proactorSendPersistentAddWatcher(enum ProactorCommands op_code, proactor_t ph, socket_t fd, int edge_triggered, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	struct Proactor* pr = (struct Proactor*)ph;
+
+	_Alignas(16) unsigned char msg[sizeof(struct Watcher) + TASK_PARAM_MAX + 16] = { op_code };
+	static_assert(sizeof(msg) < 256, "Message buffer size > 255");
+
+	unsigned int mode = WATCHER_PERSISTENT | (edge_triggered ? WATCHER_EDGE : 0);
+	unsigned char* p = msg + 2;
+	WRITE_ARG(mode,p);
+	p = proactorSendAddWatcher(pr,p,fd,pt,fn,param,param_len);
+
+	msg[1] = (p - msg);
+	assert(p - msg <= sizeof(msg));
+	proactorWriteControl(pr,msg);
+}
+
+void proactor_add_persistent_recv_watcher(proactor_t ph, socket_t fd, int edge_triggered, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	proactorSendPersistentAddWatcher(CMD_ADD_RECV_P_WATCHER,ph,fd,edge_triggered,pt,fn,param,param_len);
+}
+
+void proactor_add_persistent_send_watcher(proactor_t ph, socket_t fd, int edge_triggered, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	proactorSendPersistentAddWatcher(CMD_ADD_SEND_P_WATCHER,ph,fd,edge_triggered,pt,fn,param,param_len);
+}
+
 static void proactorAddTimedWatcher(struct Proactor* pr, unsigned char* p, unsigned int flags)
 {
-	struct Watcher* watcher = proactorAddWatcher(pr,&p,flags);
+	socket_t fd;
+	unsigned char* q = p;
+	READ_ARG(fd,q);
 
-	watcher->m_timer = proactorAddTimer(pr,p);
-	watcher->m_timer->m_param_len = watcher->m_param_len;
-	if (watcher->m_param_len)
-		memcpy(watcher->m_timer->m_param,watcher->m_param,watcher->m_param_len);
+	struct Watcher* watcher = proactorAddWatcher(pr,&p,flags,0);
+	if (!watcher)
+		return;
 
-	watcher->m_timer->m_watcher = watcher;
+	// The timer finds its watcher again by fd, and the timeout runs with the watcher's param
+	watcher->m_timer = proactorAddTimer(pr,p);
+	watcher->m_timer->m_fd = fd;
+	watcher->m_timer->m_flags = flags;
 }
 
-static void proactorSendTimedAddWatcher(enum ProactorCommands op_code, proactor_t ph, socket_t fd, uint32_t timeout, task_t pt, task_fn_t io_fn, task_fn_t tmo_fn, const void* param, unsigned int param_len)
+static void proactorSendTimedAddWatcher(enum ProactorCommands op_code, proactor_t ph, socket_t fd, uint32_t timeout, uint32_t slack, task_t pt, task_fn_t io_fn, task_fn_t tmo_fn, const void* param, unsigned int param_len)
 {
 	struct Proactor* pr = (struct Proactor*)ph;
 
-	unsigned char msg[sizeof(struct Watcher) + sizeof(struct Timer) + 16 - TASK_PARAM_MAX] = { op_code };
+	_Alignas(16) unsigned char msg[sizeof(struct Watcher) + TASK_PARAM_MAX + sizeof(struct Timer) + 16] = { op_code };
 	static_assert(sizeof(msg) < 256, "Message buffer size > 255");
 
 	unsigned char* p = proactorSendAddWatcher(pr,msg + 2,fd,pt,io_fn,param,param_len);
@@ -457,357 +1336,2265 @@ static void proactorSendTimedAddWatcher(enum ProactorCommands op_code, proactor_
 	while (id == 0)
 		id = atomic_fetch_add(&pr->m_next_timer_id,1);
 
-	p = proactorSendAddTimer(pr,p,id,timeout,0,pt,tmo_fn,NULL,0);
+	p = proactorSendAddTimer(pr,p,id,timeout * UINT64_C(1000000),0,slack * UINT64_C(1000000),0,pt,tmo_fn,NULL,0);
 
 	msg[1] = (p - msg);
 	assert(p - msg <= sizeof(msg));
 	proactorWriteControl(pr,msg);
 }
 
-void proactor_add_timed_recv_watcher(proactor_t ph, socket_t fd, uint32_t timeout, task_t pt, task_fn_t io_fn, task_fn_t tmo_fn, const void* param, unsigned int param_len)
+void proactor_add_timed_recv_watcher(proactor_t ph, socket_t fd, uint32_t timeout, uint32_t slack, task_t pt, task_fn_t io_fn, task_fn_t tmo_fn, const void* param, unsigned int param_len)
 {
-	proactorSendTimedAddWatcher(CMD_ADD_RECV_T_WATCHER,ph,fd,timeout,pt,io_fn,tmo_fn,param,param_len);
+	proactorSendTimedAddWatcher(CMD_ADD_RECV_T_WATCHER,ph,fd,timeout,slack,pt,io_fn,tmo_fn,param,param_len);
 }
 
-void proactor_add_timed_send_watcher(proactor_t ph, socket_t fd, uint32_t timeout, task_t pt, task_fn_t io_fn, task_fn_t tmo_fn, const void* param, unsigned int param_len)
+void proactor_add_timed_send_watcher(proactor_t ph, socket_t fd, uint32_t timeout, uint32_t slack, task_t pt, task_fn_t io_fn, task_fn_t tmo_fn, const void* param, unsigned int param_len)
 {
-	proactorSendTimedAddWatcher(CMD_ADD_SEND_T_WATCHER,ph,fd,timeout,pt,io_fn,tmo_fn,param,param_len);
+	proactorSendTimedAddWatcher(CMD_ADD_SEND_T_WATCHER,ph,fd,timeout,slack,pt,io_fn,tmo_fn,param,param_len);
 }
 
-static void proactorRemoveWatcher(struct Proactor* pr, size_t i)
+static unsigned int proactorOpFlags(const struct Op* op)
 {
-	// Swap array member with last member
-	if (--pr->m_n_poll_fds > 1 && i < pr->m_n_poll_fds)
+	switch (op->m_type)
 	{
-		struct Watcher* w = &pr->m_watchers[i*2];
-
-		pr->m_poll_fds[i] = pr->m_poll_fds[pr->m_n_poll_fds];
-		memcpy(w,&pr->m_watchers[pr->m_n_poll_fds*2],2 * sizeof(struct Watcher));
-
-		// Fix up timers
-		if (w->m_timer)
-			w->m_timer->m_watcher = w;
-
-		++w;
-		if (w->m_timer)
-			w->m_timer->m_watcher = w;
+	case OP_SEND:
+	case OP_SENDV:
+	case OP_SEND_DATAGRAMS:
+	case OP_SENDFILE:
+	case OP_CONNECT:
+		return POLL_EVENT_WR;
+
+	default:
+		return POLL_EVENT_RD;
 	}
 }
 
-static void proactorCancelWatcher(struct Proactor* pr, unsigned char* p, unsigned int flags)
+// The completion has been filled in
+static void proactorRunOp(struct Op* op)
 {
-	socket_t fd;
-	READ_ARG(fd,p);
-
-	size_t i = 1;
-	for (; i < pr->m_n_poll_fds; ++i)
-	{
-		if (pr->m_poll_fds[i].fd == fd)
-		{
-			if (pr->m_poll_fds[i].events & flags)
-			{
-				pr->m_poll_fds[i].events &= ~flags;
-
-				struct Watcher* watcher = &pr->m_watchers[i * 2];
-				if (flags & POLL_EVENT_WR)
-					++watcher;
-
-				if (watcher->m_timer)
-					watcher->m_timer->m_deadline = 0;
-
-				if (!pr->m_poll_fds[i].events)
-					proactorRemoveWatcher(pr,i);
-			}
-			break;
-		}
-	}
+	struct StatsCall sc;
+	const void* param = op->m_param;
+	unsigned int param_len = sizeof(struct proactor_completion) + op->m_param_len;
+	task_fn_t fn = proactorStatsWrap(op->m_proactor,op->m_fn,&param,&param_len,&sc);
+	proactorRunTask(op->m_proactor,op->m_parent,fn,param,param_len);
+	free(op->m_gather);
+	free(op);
 }
 
-void proactorSendCancelWatcher(enum ProactorCommands op_code, proactor_t ph, socket_t fd)
+static void proactorCompleteOp(struct Op* op, int result, size_t bytes, socket_t s)
 {
-	struct Proactor* pr = (struct Proactor*)ph;
+	struct proactor_completion* c = (struct proactor_completion*)op->m_param;
+	c->m_result = result;
+	c->m_socket = s;
+	c->m_bytes = bytes;
 
-	unsigned char msg[32] = { op_code };
-	unsigned char* p = msg + 2;
-
-	WRITE_ARG(fd,p);
-
-	msg[1] = (p - msg);
-	assert(p - msg <= sizeof(msg));
-	proactorWriteControl(pr,msg);
+	proactorRunOp(op);
 }
 
-void proactor_cancel_recv_watcher(proactor_t ph, socket_t fd)
+static void proactorFailOps(struct Op* op, int result)
 {
-	proactorSendCancelWatcher(CMD_CANCEL_SEND_WATCHER,ph,fd);
+	while (op)
+	{
+		struct Op* next = op->m_next;
+		proactorCompleteOp(op,result,op->m_sent,-1);
+		op = next;
+	}
 }
 
-void proactor_cancel_send_watcher(proactor_t ph, socket_t fd)
+// Only the buffer id goes with the completion, the data stays where it was received
+static void proactorCompleteBuffer(struct Op* op, size_t bytes, unsigned int id)
 {
-	proactorSendCancelWatcher(CMD_CANCEL_SEND_WATCHER,ph,fd);
+	struct proactor_completion* c = (struct proactor_completion*)op->m_param;
+	c->m_result = 0;
+	c->m_buffer_id = id;
+	c->m_bytes = bytes;
+
+	proactorRunOp(op);
 }
 
-static void proactorReadControl(struct Proactor* pr)
+// Without io_uring the proactor does the syscall itself, returns 0 if it would block
+static int proactorTryOp(struct Op* op)
 {
-	for (;;)
+	socket_t s = -1;
+	ssize_t r = -1;
+	struct BufferPool* pool = NULL;
+	unsigned int id = 0;
+	switch (op->m_type)
 	{
-#if defined(_WIN32)
-		int r = recv(pr->m_poll_fds[0].fd,(void*)pr->m_control_buf + pr->m_control_offset,sizeof(pr->m_control_buf) - pr->m_control_offset,0);
-		if (r == -1 && WSAGetLastError() == WSAEWOULDBLOCK)
-			break;
-#else
-		ssize_t r;
-		do
-			r = recv(pr->m_poll_fds[0].fd,pr->m_control_buf + pr->m_control_offset,sizeof(pr->m_control_buf) - pr->m_control_offset,0);
-		while (r == -1 && errno == EINTR);
+	case OP_RECV:
+		r = recv(op->m_fd,op->m_buf,op->m_len,MSG_DONTWAIT);
+		break;
 
-		if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
-			break;
-#endif
-		if (r == 0)
+	case OP_RECV_BUFFER:
+		pool = op->m_buf;
+		if (!pool->m_free_count)
 		{
-			// Control fd has closed, this means exit!
-			assert(pr->m_control_offset == 0);
-			assert(pr->m_n_poll_fds == 1);
-
-			closesocket(pr->m_poll_fds[0].fd);
-			pr->m_n_poll_fds = 0;
+			// As io_uring does, with nothing to select from
+			errno = ENOBUFS;
 			break;
 		}
 
-		if (r < 0)
-			abort();
-
-		pr->m_control_offset += r;
-		size_t p = 0;
-		for (; p + 2 <= pr->m_control_offset && pr->m_control_offset >= p + pr->m_control_buf[p+1]; p += pr->m_control_buf[p+1])
-		{
-			switch (pr->m_control_buf[p])
-			{
-			case CMD_ADD_TIMER:
-				proactorAddTimer(pr,&pr->m_control_buf[p+2]);
-				break;
+		id = pool->m_free[pool->m_free_count - 1];
+		r = recv(op->m_fd,pool->m_base + id * pool->m_size,pool->m_size,MSG_DONTWAIT);
+		if (r > 0)
+			--pool->m_free_count;
+		break;
 
-			case CMD_CANCEL_TIMER:
-				proactorCancelTimer(pr,&pr->m_control_buf[p+2]);
-				break;
+	case OP_SEND:
+		r = send(op->m_fd,op->m_buf,op->m_len,MSG_DONTWAIT | MSG_NOSIGNAL);
+		break;
 
-			case CMD_UPDATE_TIMER:
-				proactorUpdateTimer(pr,&pr->m_control_buf[p+2]);
-				break;
+	case OP_ACCEPT:
+#if defined(__linux__)
+		r = s = accept4(op->m_fd,NULL,NULL,SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+		r = s = accept(op->m_fd,NULL,NULL);
+#endif
+		break;
 
-			case CMD_ADD_RECV_WATCHER:
-				{
-					unsigned char* pp = &pr->m_control_buf[p+2];
-					proactorAddWatcher(pr,&pp,POLL_EVENT_RD);
-					break;
-				}
+#if defined(__linux__)
+	case OP_RECV_DATAGRAMS:
+		// As many as are waiting, up to the caller's array, for one completion
+		r = recvmmsg(op->m_fd,op->m_buf,op->m_len,MSG_DONTWAIT,NULL);
+		break;
 
-			case CMD_ADD_RECV_T_WATCHER:
-				proactorAddTimedWatcher(pr,&pr->m_control_buf[p+2],POLL_EVENT_RD);
-				break;
+	case OP_SEND_DATAGRAMS:
+		r = sendmmsg(op->m_fd,(struct mmsghdr*)op->m_buf + op->m_sent,op->m_len - op->m_sent,MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (r > 0)
+		{
+			op->m_sent += r;
+			if (op->m_sent < op->m_len)
+				return 0;
 
-			case CMD_CANCEL_RECV_WATCHER:
-				proactorCancelWatcher(pr,&pr->m_control_buf[p+2],POLL_EVENT_RD);
-				break;
+			r = op->m_sent;
+		}
+		break;
 
-			case CMD_ADD_SEND_WATCHER:
-				{
-					unsigned char* pp = &pr->m_control_buf[p+2];
-					proactorAddWatcher(pr,&pp,POLL_EVENT_WR);
+	case OP_SENDFILE:
+		{
+			// The file goes straight to the socket, until the socket is full or the file ends
+			const struct SendFile* f = op->m_buf;
+			r = 0;
+			while (op->m_sent < op->m_len)
+			{
+				off_t offset = f->m_offset + op->m_sent;
+				size_t chunk = op->m_len - op->m_sent;
+				r = sendfile(op->m_fd,f->m_file,&offset,chunk < SENDFILE_CHUNK ? chunk : SENDFILE_CHUNK);
+				if (r <= 0)
 					break;
-				}
 
-			case CMD_ADD_SEND_T_WATCHER:
-				proactorAddTimedWatcher(pr,&pr->m_control_buf[p+2],POLL_EVENT_WR);
-				break;
+				op->m_sent += r;
+			}
 
-			case CMD_CANCEL_SEND_WATCHER:
-				proactorCancelWatcher(pr,&pr->m_control_buf[p+2],POLL_EVENT_WR);
-				break;
+			if (r != -1)
+				r = op->m_sent;
+		}
+		break;
+#endif
 
-			default:
-				abort();
+	case OP_CONNECT:
+		if (!op->m_started)
+		{
+			op->m_started = 1;
+			r = connect(op->m_fd,(const struct sockaddr*)op->m_buf,(socklen_t)op->m_len);
+			if (r == -1 && errno == EINPROGRESS)
+				return 0;
+		}
+		else
+		{
+			// Writable, so the connect has finished one way or another
+			int err = 0;
+			socklen_t len = sizeof(err);
+			r = getsockopt(op->m_fd,SOL_SOCKET,SO_ERROR,(void*)&err,&len);
+			if (r == 0 && err)
+			{
+				errno = err;
+				r = -1;
 			}
 		}
+		break;
+	}
+
+	if (r == -1)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
 
-		if (p < pr->m_control_offset)
-			memmove(pr->m_control_buf,pr->m_control_buf + p,pr->m_control_offset - p);
-		pr->m_control_offset -= p;
+		proactorCompleteOp(op,errno,op->m_sent,-1);
 	}
+	else if (pool && r > 0)
+		proactorCompleteBuffer(op,(size_t)r,id);
+	else
+		proactorCompleteOp(op,0,(op->m_type == OP_ACCEPT || op->m_type == OP_CONNECT) ? 0 : (size_t)r,s);
+
+	return 1;
 }
 
-static int proactorPoll(struct Proactor* pr, int timeout)
+#if !defined(_WIN32)
+// Fills iov from the sendv operations at the head of the queue, returns how many
+static int proactorGatherSends(const struct Op* op, struct iovec* iov, size_t* bytes)
 {
-	int ret;
-#if defined(_WIN32)
-	ret = WSAPoll(pr->m_poll_fds,pr->m_n_poll_fds,timeout);
-	if (ret == -1 && WSAGetLastError() == WSAENOBUFS)
-		ret = WSAPoll(pr->m_poll_fds,pr->m_n_poll_fds / 2,timeout);
-#else
-	do
-		ret = poll(pr->m_poll_fds,pr->m_n_poll_fds,timeout);
-	while (ret == -1 && (errno == EINTR || errno == EAGAIN));
-
-	if (ret == -1 && errno == ENOMEM)
+	int n = 0;
+	*bytes = 0;
+	for (; op && op->m_type == OP_SENDV && n < SENDV_IOV_MAX; op = op->m_next)
 	{
-		do
-			ret = poll(pr->m_poll_fds,pr->m_n_poll_fds / 2,timeout);
-		while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+		const struct iovec* v = op->m_buf;
+		for (size_t i = 0; i < op->m_len && n < SENDV_IOV_MAX; ++i)
+		{
+			*bytes += v[i].iov_len;
+			iov[n++] = v[i];
+		}
 	}
-#endif
-	if (ret == -1)
-		abort();
-
-	return ret;
+	return n;
 }
 
-static void proactorRun(task_t task, void* param)
+// Completes the sendv operations that bytes covers, and trims the one it ends part way through
+static void proactorSentOps(struct Watcher* w, size_t bytes)
 {
-	for (struct Proactor* pr = *(struct Proactor* const*)param; pr->m_n_poll_fds > 0; )
+	while (w->m_ops && w->m_ops->m_type == OP_SENDV)
 	{
-		// Loop through timers, firing off expired tasks, back to front!
-		uint64_t tNow = timeNow();
-		size_t i;
-		for (i = pr->m_timer_count; i-- > 0 && pr->m_timers[i].m_deadline <= tNow;)
+		struct Op* op = w->m_ops;
+		struct iovec* v = op->m_buf;
+		for (; op->m_len && bytes >= v->iov_len; ++v, --op->m_len)
 		{
-			if (pr->m_timers[i].m_deadline)
-			{
-				task_run(pr->m_timers[i].m_parent,pr->m_timers[i].m_fn,pr->m_timers[i].m_param,pr->m_timers[i].m_param_len);
+			bytes -= v->iov_len;
+			op->m_sent += v->iov_len;
+		}
+		op->m_buf = v;
 
-				if (pr->m_timers[i].m_repeat != 0)
-				{
-					pr->m_timers[i].m_deadline = tNow + pr->m_timers[i].m_repeat;
-					pr->m_timer_count = i;
-					proactorReorderTimer(pr,&pr->m_timers[i]);
-					i = pr->m_timer_count;
-				}
-			}
+		if (op->m_len)
+		{
+			v->iov_base = (char*)v->iov_base + bytes;
+			v->iov_len -= bytes;
+			op->m_sent += bytes;
+			return;
 		}
-		pr->m_timer_count = i + 1;
 
-		// Poll
-		int timeout = -1;
-		if (pr->m_timer_count)
-			timeout = pr->m_timers[pr->m_timer_count-1].m_deadline - tNow;
+		w->m_ops = op->m_next;
+		proactorCompleteOp(op,0,op->m_sent,-1);
+	}
+	if (!w->m_ops)
+		w->m_ops_tail = NULL;
+}
 
-		int fds = proactorPoll(pr,timeout);
+// One sendmsg() for as much of the queue as it will take, returns 0 if it would block
+static int proactorTrySends(struct Watcher* w)
+{
+	struct iovec iov[SENDV_IOV_MAX];
+	size_t bytes;
+	struct msghdr msg = { .msg_iov = iov };
+	msg.msg_iovlen = proactorGatherSends(w->m_ops,iov,&bytes);
 
-		// Check watchers
-		for (i = 0; i < pr->m_n_poll_fds && fds > 0; ++i)
-		{
-			if (pr->m_poll_fds[i].revents)
-			{
-				--fds;
-				if (i == 0)
-				{
-					// Do the message pipe i/o
-					proactorReadControl(pr);
-					continue;
-				}
+	ssize_t r = sendmsg(w->m_ops->m_fd,&msg,MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (r == -1)
+	{
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
 
-				struct Watcher* rd_watcher = &pr->m_watchers[i*2];
-				if ((pr->m_poll_fds[i].events & POLL_EVENT_RD) && (pr->m_poll_fds[i].revents & (POLLERR | POLLHUP | POLL_EVENT_RD)))
-				{
-					// Run the read task
-					task_run(rd_watcher->m_parent,rd_watcher->m_fn,rd_watcher->m_param,rd_watcher->m_param_len);
+		struct Op* op = w->m_ops;
+		w->m_ops = op->m_next;
+		proactorCompleteOp(op,errno,op->m_sent,-1);
+		return 1;
+	}
 
-					if (rd_watcher->m_timer)
-						rd_watcher->m_timer->m_deadline = 0;
+	proactorSentOps(w,(size_t)r);
 
-					pr->m_poll_fds[i].events &= ~POLL_EVENT_RD;
-				}
+	// A short write means the socket buffer is full
+	return (size_t)r == bytes;
+}
+#endif
 
-				if ((pr->m_poll_fds[i].events & POLL_EVENT_WR) && (pr->m_poll_fds[i].revents & (POLLERR | POLL_EVENT_WR)))
-				{
-					// Run the write task
-					struct Watcher* wr_watcher = rd_watcher+1;
-					task_run(wr_watcher->m_parent,wr_watcher->m_fn,wr_watcher->m_param,wr_watcher->m_param_len);
+// The fd is ready, so run queued operations until one would block, returns non-zero if any are left
+static int proactorReadyOps(struct Watcher* w)
+{
+	while (w->m_ops)
+	{
+#if !defined(_WIN32)
+		if (w->m_ops->m_type == OP_SENDV)
+		{
+			if (!proactorTrySends(w))
+				return 1;
+			continue;
+		}
+#endif
+		struct Op* next = w->m_ops->m_next;
+		if (!proactorTryOp(w->m_ops))
+			return 1;
 
-					if (wr_watcher->m_timer)
-						wr_watcher->m_timer->m_deadline = 0;
+		w->m_ops = next;
+	}
+	w->m_ops_tail = NULL;
+	return 0;
+}
 
-					pr->m_poll_fds[i].events &= ~POLL_EVENT_WR;
-				}
+#if defined(PROACTOR_URING)
+// A sendv at the head of a queue takes everything queued behind it along, and the kernel needs the message until it completes
+struct SendGather
+{
+	struct msghdr m_msg;
+	struct iovec  m_iov[SENDV_IOV_MAX];
+	unsigned int  m_ops;        // How many of the queue's operations the message covers, the last perhaps only in part
+	int           m_cancelled;
+};
 
-				if (!pr->m_poll_fds[i].events)
-				{
-					proactorRemoveWatcher(pr,i);
+static struct io_uring_sqe* proactorGetSqe(struct Proactor* pr)
+{
+	struct io_uring_sqe* sqe;
+	while (!(sqe = uringGetSqe(&pr->m_uring)))
+		uringSubmit(&pr->m_uring);
 
-					// Check i again
-					--i;
-				}
-			}
-		}
-	}
+	return sqe;
 }
 
-static int proactorSocketPair(socket_t* fd1, socket_t* fd2)
+// Queued only, the whole batch is submitted before the proactor next waits
+static void proactorSubmitOp(struct Proactor* pr, struct Op* op)
 {
-	int err = 0;
-#if defined(_WIN32)
-	// TODO: Use a loopback TCP socket
-#else
-	int fds[2] = {-1, -1};
-	err = socketpair(AF_UNIX,SOCK_STREAM | SOCK_CLOEXEC,0,fds);
-	if (!err)
+	struct io_uring_sqe* sqe = proactorGetSqe(pr);
+	sqe->fd = op->m_fd;
+	sqe->user_data = (uintptr_t)op;
+
+	switch (op->m_type)
 	{
-		// Set fd2 to O_NONBLOCK
-		int flags = fcntl(fds[1], F_GETFL, 0);
-		if (flags == -1)
-			err = errno;
-		else
+	case OP_RECV:
+		sqe->opcode = IORING_OP_RECV;
+		sqe->addr = (uintptr_t)op->m_buf;
+		sqe->len = op->m_len > UINT32_MAX ? UINT32_MAX : op->m_len;
+		break;
+
+	case OP_SEND:
+		sqe->opcode = IORING_OP_SEND;
+		sqe->addr = (uintptr_t)op->m_buf;
+		sqe->len = op->m_len > UINT32_MAX ? UINT32_MAX : op->m_len;
+		sqe->msg_flags = MSG_NOSIGNAL;
+		break;
+
+	case OP_ACCEPT:
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+		break;
+
+	case OP_CONNECT:
+		sqe->opcode = IORING_OP_CONNECT;
+		sqe->addr = (uintptr_t)op->m_buf;
+		sqe->off = op->m_len;
+		break;
+
+	case OP_RECV_BUFFER:
+		// The kernel picks a buffer from the group once data arrives
+		sqe->opcode = IORING_OP_RECV;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = ((struct BufferPool*)op->m_buf)->m_group;
+		sqe->len = ((struct BufferPool*)op->m_buf)->m_size;
+		break;
+
+	case OP_RECV_DATAGRAMS:
+	case OP_SEND_DATAGRAMS:
+	case OP_SENDFILE:
+		// There is no batched or sendfile opcode, so the ring waits for readiness and the proactor makes the call
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->poll_events = proactorOpFlags(op);
+		break;
+
+	case OP_READ_FILE:
+		sqe->opcode = IORING_OP_READ;
+		sqe->addr = (uintptr_t)op->m_buf;
+		sqe->len = op->m_len > UINT32_MAX ? UINT32_MAX : op->m_len;
+		sqe->off = op->m_offset;
+		break;
+
+	case OP_WRITE_FILE:
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->addr = (uintptr_t)op->m_buf;
+		sqe->len = op->m_len > UINT32_MAX ? UINT32_MAX : op->m_len;
+		sqe->off = op->m_offset;
+		break;
+
+	case OP_FSYNC_FILE:
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->fsync_flags = op->m_len ? IORING_FSYNC_DATASYNC : 0;
+		break;
+
+	case OP_SENDV:
 		{
-			flags |= O_NONBLOCK;
-			err = fcntl(fds[1], F_SETFL, flags);
-		}
+			struct SendGather* g = op->m_gather;
+			if (!g && !(g = op->m_gather = malloc(sizeof(struct SendGather))))
+				abort();
 
-		if (err)
-		{
-			closesocket(fds[0]);
-			closesocket(fds[1]);
-		}
-		else
-		{
-			*fd1 = fds[0];
-			*fd2 = fds[1];
+			size_t bytes;
+			memset(&g->m_msg,0,sizeof(g->m_msg));
+			g->m_msg.msg_iov = g->m_iov;
+			g->m_msg.msg_iovlen = proactorGatherSends(op,g->m_iov,&bytes);
+			g->m_cancelled = 0;
+
+			size_t n = 0;
+			g->m_ops = 0;
+			for (const struct Op* o = op; o && n < g->m_msg.msg_iovlen; o = o->m_next, ++g->m_ops)
+				n += o->m_len;
+
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->addr = (uintptr_t)&g->m_msg;
+			sqe->len = 1;
+			sqe->msg_flags = MSG_NOSIGNAL;
+			break;
 		}
 	}
-#endif
-	return err;
 }
 
-proactor_t proactor_create(task_t parent)
+// Provided buffers arrived with fast poll, in 5.7, so any kernel we use the ring on has them
+static void proactorProvideBuffers(struct Proactor* pr, struct BufferPool* pool, unsigned int id, unsigned int count)
 {
-	struct Proactor* pr = malloc(sizeof(struct Proactor));
+	struct io_uring_sqe* sqe = proactorGetSqe(pr);
+	sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+	sqe->fd = count;
+	sqe->addr = (uintptr_t)(pool->m_base + id * pool->m_size);
+	sqe->len = pool->m_size;
+	sqe->off = id;
+	sqe->buf_group = pool->m_group;
+}
+
+static void proactorReapUring(struct Proactor* pr)
+{
+	struct io_uring_cqe* cqe;
+	do
+	{
+		while ((cqe = uringPeek(&pr->m_uring)))
+		{
+			struct Op* op = (struct Op*)(uintptr_t)cqe->user_data;
+			int res = cqe->res;
+			unsigned int cqe_flags = cqe->flags;
+			uringAdvance(&pr->m_uring);
+
+			// Cancel and buffer requests complete too, with nothing attached
+			if (!op)
+				continue;
+
+			if (op->m_type >= OP_READ_FILE)
+			{
+				if (res < 0)
+					proactorCompleteOp(op,-res,0,-1);
+				else
+					proactorCompleteOp(op,0,(size_t)res,-1);
+
+				proactorFileDone(pr);
+				continue;
+			}
+
+			// Only the head of each queue is in flight, so start the next one
+			unsigned int flags = proactorOpFlags(op);
+			struct FdEntry* e = &pr->m_fds[op->m_fd];
+			struct Watcher* w = e->m_watchers[(flags & POLL_EVENT_WR) ? 1 : 0];
+			assert(w->m_ops == op);
+
+			if (op->m_type == OP_SENDV && (res >= 0 || ((struct SendGather*)op->m_gather)->m_cancelled))
+			{
+				// The head may be completed and freed along with its message
+				const struct SendGather* g = op->m_gather;
+				int cancelled = g->m_cancelled;
+				struct Op* after = op;
+				for (unsigned int i = 0; i < g->m_ops && after; ++i)
+					after = after->m_next;
+
+				// The message may have covered several operations, or only part of this one
+				if (res >= 0)
+					proactorSentOps(w,(size_t)res);
+
+				// Cancelled, whatever the kernel didn't send fails, and only now, as it held the buffers until here
+				if (cancelled)
+				{
+					while (w->m_ops != after)
+					{
+						struct Op* o = w->m_ops;
+						w->m_ops = o->m_next;
+						proactorCompleteOp(o,ECANCELED,o->m_sent,-1);
+					}
+					if (!w->m_ops)
+						w->m_ops_tail = NULL;
+				}
+
+				if (w->m_ops)
+					proactorSubmitOp(pr,w->m_ops);
+				else
+					proactorReleaseWatchers(pr,e->m_watchers,flags);
+				continue;
+			}
+
+			if ((op->m_type == OP_RECV_DATAGRAMS || op->m_type == OP_SEND_DATAGRAMS || op->m_type == OP_SENDFILE) && res >= 0)
+			{
+				// Polled ready, unless someone else got there first
+				struct Op* next = op->m_next;
+				if (!proactorTryOp(op))
+				{
+					proactorSubmitOp(pr,op);
+					continue;
+				}
+
+				w->m_ops = next;
+				if (w->m_ops)
+					proactorSubmitOp(pr,w->m_ops);
+				else
+					proactorReleaseWatchers(pr,e->m_watchers,flags);
+				continue;
+			}
+
+			w->m_ops = op->m_next;
+			if (w->m_ops)
+				proactorSubmitOp(pr,w->m_ops);
+			else
+				proactorReleaseWatchers(pr,e->m_watchers,flags);
+
+			if (cqe_flags & IORING_CQE_F_BUFFER)
+			{
+				unsigned int id = cqe_flags >> IORING_CQE_BUFFER_SHIFT;
+				if (res > 0)
+				{
+					proactorCompleteBuffer(op,(size_t)res,id);
+					continue;
+				}
+
+				// Nothing was received into it, so it goes straight back
+				proactorProvideBuffers(pr,op->m_buf,id,1);
+			}
+
+			if (res < 0)
+				proactorCompleteOp(op,-res,op->m_sent,-1);
+			else
+				proactorCompleteOp(op,0,(op->m_type == OP_RECV || op->m_type == OP_SEND) ? (size_t)res : 0,op->m_type == OP_ACCEPT ? res : -1);
+		}
+	}
+	while (uringFlushOverflow(&pr->m_uring));
+}
+#endif
+
+static void proactorCancelOps(struct Proactor* pr, struct Watcher* w)
+{
+	struct Op* op = w->m_ops;
+#if defined(PROACTOR_URING)
+	if (pr->m_uring.m_fd != -1)
+	{
+		// The head is in flight, the kernel will complete it with ECANCELED
+		struct io_uring_sqe* sqe = proactorGetSqe(pr);
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->addr = (uintptr_t)op;
+
+		// So are any sendv operations its message covers, they are settled when it completes
+		struct Op* last = op;
+		if (op->m_type == OP_SENDV && op->m_gather)
+		{
+			struct SendGather* g = op->m_gather;
+			g->m_cancelled = 1;
+			for (unsigned int i = 1; i < g->m_ops && last->m_next; ++i)
+				last = last->m_next;
+		}
+
+		op = last->m_next;
+		last->m_next = NULL;
+		w->m_ops_tail = last;
+	}
+	else
+#endif
+	{
+		w->m_ops = w->m_ops_tail = NULL;
+	}
+
+	proactorFailOps(op,ECANCELED);
+}
+
+#if !defined(_WIN32)
+// A blocking file i/o thread, the result goes back through the proactor to be run as a task
+static int proactorFileThread(void* param)
+{
+	struct Proactor* pr = param;
+	for (;;)
+	{
+		if (sema_wait(&pr->m_file_sema) != thrd_success)
+			abort();
+
+		// The semaphore says it is there, it may just not be visible yet
+		struct Op* op;
+		while (ringRecv(&pr->m_file_jobs,&op,1) != 1)
+			thrd_yield();
+
+		if (!op)
+			return 0;
+
+		ssize_t r = 0;
+		switch (op->m_type)
+		{
+		case OP_READ_FILE:
+			do
+				r = pread(op->m_fd,op->m_buf,op->m_len,op->m_offset);
+			while (r == -1 && errno == EINTR);
+			break;
+
+		case OP_WRITE_FILE:
+			do
+				r = pwrite(op->m_fd,op->m_buf,op->m_len,op->m_offset);
+			while (r == -1 && errno == EINTR);
+			break;
+
+		case OP_FSYNC_FILE:
+#if defined(__linux__)
+			r = op->m_len ? fdatasync(op->m_fd) : fsync(op->m_fd);
+#else
+			r = fsync(op->m_fd);
+#endif
+			break;
+		}
+
+		struct proactor_completion* c = (struct proactor_completion*)op->m_param;
+		c->m_result = (r == -1) ? errno : 0;
+		c->m_socket = -1;
+		c->m_bytes = (r == -1) ? 0 : (size_t)r;
+
+		_Alignas(16) unsigned char msg[16] = { CMD_FILE_DONE };
+		unsigned char* p = msg + 2;
+		WRITE_ARG(op,p);
+		msg[1] = (p - msg);
+		proactorWriteControl(pr,msg);
+	}
+}
+
+static void proactorStartFileThreads(struct Proactor* pr)
+{
+	ringInit(&pr->m_file_jobs,FILE_QUEUE,sizeof(struct Op*));
+	if (sema_init(&pr->m_file_sema,0) != thrd_success)
+		abort();
+
+	for (; pr->m_file_thread_count < FILE_THREADS; ++pr->m_file_thread_count)
+	{
+		if (thrd_create(&pr->m_file_threads[pr->m_file_thread_count],&proactorFileThread,pr) != thrd_success)
+			abort();
+	}
+}
+
+static void proactorStartFileOp(struct Proactor* pr, struct Op* op)
+{
+	++pr->m_file_inflight;
+#if defined(PROACTOR_URING)
+	if (pr->m_uring.m_fd != -1)
+	{
+		proactorSubmitOp(pr,op);
+		return;
+	}
+#endif
+	if (!pr->m_file_thread_count)
+		proactorStartFileThreads(pr);
+
+	// No more than FILE_QUEUE are in flight, but a file thread may still be copying a job out of the cell we need
+	while (ringSend(&pr->m_file_jobs,&op,1) != 1)
+		thrd_yield();
+
+	if (sema_signal(&pr->m_file_sema,1) != thrd_success)
+		abort();
+}
+
+static void proactorQueueFileOp(struct Proactor* pr, struct Op* op)
+{
+	if (pr->m_file_inflight < FILE_QUEUE)
+		proactorStartFileOp(pr,op);
+	else if (pr->m_file_backlog)
+	{
+		pr->m_file_backlog_tail->m_next = op;
+		pr->m_file_backlog_tail = op;
+	}
+	else
+		pr->m_file_backlog = pr->m_file_backlog_tail = op;
+}
+
+// A file operation has completed, so another can start
+static void proactorFileDone(struct Proactor* pr)
+{
+	--pr->m_file_inflight;
+
+	struct Op* next = pr->m_file_backlog;
+	if (next)
+	{
+		pr->m_file_backlog = next->m_next;
+		next->m_next = NULL;
+		proactorStartFileOp(pr,next);
+	}
+}
+
+static void proactorStopFileThreads(struct Proactor* pr)
+{
+	if (!pr->m_file_thread_count)
+		return;
+
+	// A NULL job each, behind anything still queued
+	struct Op* stop = NULL;
+	for (unsigned int i = 0; i < pr->m_file_thread_count; ++i)
+	{
+		while (ringSend(&pr->m_file_jobs,&stop,1) != 1)
+			thrd_yield();
+	}
+	if (sema_signal(&pr->m_file_sema,pr->m_file_thread_count) != thrd_success)
+		abort();
+
+	for (unsigned int i = 0; i < pr->m_file_thread_count; ++i)
+		thrd_join(pr->m_file_threads[i],NULL);
+
+	sema_destroy(&pr->m_file_sema);
+	ringDestroy(&pr->m_file_jobs);
+	pr->m_file_thread_count = 0;
+}
+#endif
+
+static void proactorAddOp(struct Proactor* pr, unsigned char* p)
+{
+	struct Op* op;
+	READ_ARG(op,p);
+
+#if !defined(_WIN32)
+	if (op->m_type >= OP_READ_FILE)
+	{
+		proactorQueueFileOp(pr,op);
+		return;
+	}
+#endif
+
+	unsigned int flags = proactorOpFlags(op);
+	struct Watcher* w;
+
+	if (flags & POLL_EVENT_WR)
+	{
+		// Anything sent after a held back sendv waits with it
+		for (size_t i = 0; i < pr->m_send_count; ++i)
+		{
+			if (pr->m_sends[i]->m_fd == op->m_fd)
+			{
+				struct Op* tail = pr->m_sends[i];
+				while (tail->m_next)
+					tail = tail->m_next;
+				tail->m_next = op;
+				return;
+			}
+		}
+	}
+
+#if defined(PROACTOR_URING)
+	if (pr->m_uring.m_fd != -1)
+	{
+		struct FdEntry* e = proactorFdEntry(pr,op->m_fd);
+		if (e->m_events & flags)
+		{
+			// A watcher has this direction
+			proactorCompleteOp(op,EBUSY,0,-1);
+			return;
+		}
+
+		w = e->m_watchers[(flags & POLL_EVENT_WR) ? 1 : 0];
+		if (w)
+		{
+			w->m_ops_tail->m_next = op;
+			w->m_ops_tail = op;
+		}
+		else if (op->m_type == OP_SENDV)
+			pr->m_sends[pr->m_send_count++] = op;
+		else
+		{
+			w = e->m_watchers[(flags & POLL_EVENT_WR) ? 1 : 0] = proactorAllocWatcher(pr,0);
+			w->m_ops = w->m_ops_tail = op;
+			proactorSubmitOp(pr,op);
+		}
+		return;
+	}
+#endif
+
+	w = proactorFindWatcher(pr,op->m_fd,flags);
+	if (w)
+	{
+		if (!w->m_ops)
+			proactorCompleteOp(op,EBUSY,0,-1);
+		else
+		{
+			w->m_ops_tail->m_next = op;
+			w->m_ops_tail = op;
+		}
+		return;
+	}
+
+	// Held back until the rest of the batch has been read, in case more follows for this socket
+	if (op->m_type == OP_SENDV)
+	{
+		pr->m_sends[pr->m_send_count++] = op;
+		return;
+	}
+
+	// Nothing ahead of it, so it might not need to wait at all
+	if (proactorTryOp(op))
+		return;
+
+	w = proactorArm(pr,op->m_fd,flags,0,0);
+	if (!w)
+	{
+		proactorCompleteOp(op,errno,0,-1);
+		return;
+	}
+
+	w->m_ops = w->m_ops_tail = op;
+}
+
+// Each socket's held back sends go as one gathered sendmsg()
+static void proactorFlushSends(struct Proactor* pr)
+{
+	for (size_t i = 0; i < pr->m_send_count; ++i)
+	{
+		struct Watcher q = { .m_ops = pr->m_sends[i] };
+		for (q.m_ops_tail = q.m_ops; q.m_ops_tail->m_next; q.m_ops_tail = q.m_ops_tail->m_next)
+			;
+
+#if defined(PROACTOR_URING)
+		if (pr->m_uring.m_fd != -1)
+		{
+			// A watcher may have been added behind it
+			struct FdEntry* e = proactorFdEntry(pr,q.m_ops->m_fd);
+			if (e->m_events & POLL_EVENT_WR)
+				proactorFailOps(q.m_ops,EBUSY);
+			else
+			{
+				e->m_watchers[1] = proactorAllocWatcher(pr,0);
+				e->m_watchers[1]->m_ops = q.m_ops;
+				e->m_watchers[1]->m_ops_tail = q.m_ops_tail;
+				proactorSubmitOp(pr,q.m_ops);
+			}
+			continue;
+		}
+#endif
+		if (proactorFindWatcher(pr,q.m_ops->m_fd,POLL_EVENT_WR))
+		{
+			proactorFailOps(q.m_ops,EBUSY);
+			continue;
+		}
+
+		if (!proactorReadyOps(&q))
+			continue;
+
+		struct Watcher* w = proactorArm(pr,q.m_ops->m_fd,POLL_EVENT_WR,0,0);
+		if (!w)
+		{
+			proactorFailOps(q.m_ops,errno);
+			continue;
+		}
+
+		w->m_ops = q.m_ops;
+		w->m_ops_tail = q.m_ops_tail;
+	}
+	pr->m_send_count = 0;
+}
+
+static struct Op* proactorNewOp(unsigned int type, socket_t fd, size_t extra, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (!fn || param_len > PROACTOR_PARAM_MAX)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct Op* op = malloc(sizeof(struct Op) + extra);
+	if (!op)
+		abort();
+
+	op->m_next = NULL;
+	op->m_type = type;
+	op->m_started = 0;
+	op->m_fd = fd;
+	op->m_buf = NULL;
+	op->m_len = 0;
+	op->m_sent = 0;
+	op->m_gather = NULL;
+	op->m_offset = 0;
+	op->m_parent = pt;
+	op->m_fn = fn;
+	op->m_param_len = param_len;
+	if (param_len)
+		memcpy(op->m_param + sizeof(struct proactor_completion),param,param_len);
+
+	return op;
+}
+
+static int proactorSendOp(proactor_t ph, struct Op* op)
+{
+	struct Proactor* pr = (struct Proactor*)ph;
+	op->m_proactor = pr;
+
+	_Alignas(16) unsigned char msg[16] = { CMD_ADD_OP };
+	unsigned char* p = msg + 2;
+
+	WRITE_ARG(op,p);
+
+	msg[1] = (p - msg);
+	assert(p - msg <= sizeof(msg));
+	proactorWriteControl(pr,msg);
+	return 0;
+}
+
+int proactor_recv(proactor_t ph, socket_t fd, void* buf, size_t len, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	struct Op* op = proactorNewOp(OP_RECV,fd,0,pt,fn,param,param_len);
+	if (!op)
+		return -1;
+
+	op->m_buf = buf;
+	op->m_len = len;
+	return proactorSendOp(ph,op);
+}
+
+int proactor_send(proactor_t ph, socket_t fd, const void* buf, size_t len, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	struct Op* op = proactorNewOp(OP_SEND,fd,0,pt,fn,param,param_len);
+	if (!op)
+		return -1;
+
+	op->m_buf = (void*)buf;
+	op->m_len = len;
+	return proactorSendOp(ph,op);
+}
+
+#if !defined(_WIN32)
+int proactor_sendv(proactor_t ph, socket_t fd, const struct iovec* iov, int iovcnt, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (iovcnt < 0 || (iovcnt && !iov))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	// The iovecs are kept with the operation, and trimmed as they are sent
+	struct Op* op = proactorNewOp(OP_SENDV,fd,iovcnt * sizeof(struct iovec),pt,fn,param,param_len);
+	if (!op)
+		return -1;
+
+	op->m_buf = op + 1;
+	op->m_len = iovcnt;
+	if (iovcnt)
+		memcpy(op->m_buf,iov,iovcnt * sizeof(struct iovec));
+	return proactorSendOp(ph,op);
+}
+#endif
+
+#if defined(__linux__)
+int proactor_recv_datagrams(proactor_t ph, socket_t fd, struct mmsghdr* msgs, unsigned int vlen, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (!msgs || !vlen)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct Op* op = proactorNewOp(OP_RECV_DATAGRAMS,fd,0,pt,fn,param,param_len);
+	if (!op)
+		return -1;
+
+	op->m_buf = msgs;
+	op->m_len = vlen;
+	return proactorSendOp(ph,op);
+}
+
+int proactor_send_datagrams(proactor_t ph, socket_t fd, struct mmsghdr* msgs, unsigned int vlen, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (!msgs || !vlen)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct Op* op = proactorNewOp(OP_SEND_DATAGRAMS,fd,0,pt,fn,param,param_len);
+	if (!op)
+		return -1;
+
+	op->m_buf = msgs;
+	op->m_len = vlen;
+	return proactorSendOp(ph,op);
+}
+
+int proactor_sendfile(proactor_t ph, socket_t fd, int file_fd, uint64_t offset, size_t len, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (file_fd < 0)
+	{
+		errno = EBADF;
+		return -1;
+	}
+
+	struct Op* op = proactorNewOp(OP_SENDFILE,fd,sizeof(struct SendFile),pt,fn,param,param_len);
+	if (!op)
+		return -1;
+
+	struct SendFile* f = op->m_buf = op + 1;
+	f->m_file = file_fd;
+	f->m_offset = offset;
+	op->m_len = len;
+	return proactorSendOp(ph,op);
+}
+#endif
+
+#if !defined(_WIN32)
+static int proactorSendFileOp(proactor_t ph, unsigned int type, int fd, void* buf, size_t len, uint64_t offset, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (fd < 0)
+	{
+		errno = EBADF;
+		return -1;
+	}
+
+	struct Op* op = proactorNewOp(type,fd,0,pt,fn,param,param_len);
+	if (!op)
+		return -1;
+
+	op->m_buf = buf;
+	op->m_len = len;
+	op->m_offset = offset;
+	return proactorSendOp(ph,op);
+}
+
+int proactor_read_file(proactor_t ph, int fd, void* buf, size_t len, uint64_t offset, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	return proactorSendFileOp(ph,OP_READ_FILE,fd,buf,len,offset,pt,fn,param,param_len);
+}
+
+int proactor_write_file(proactor_t ph, int fd, const void* buf, size_t len, uint64_t offset, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	return proactorSendFileOp(ph,OP_WRITE_FILE,fd,(void*)buf,len,offset,pt,fn,param,param_len);
+}
+
+int proactor_fsync_file(proactor_t ph, int fd, int datasync, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	return proactorSendFileOp(ph,OP_FSYNC_FILE,fd,NULL,datasync ? 1 : 0,0,pt,fn,param,param_len);
+}
+#endif
+
+int proactor_accept(proactor_t ph, socket_t fd, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	struct Op* op = proactorNewOp(OP_ACCEPT,fd,0,pt,fn,param,param_len);
+	if (!op)
+		return -1;
+
+	return proactorSendOp(ph,op);
+}
+
+int proactor_connect(proactor_t ph, socket_t fd, const struct sockaddr* addr, socklen_t addr_len, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (!addr)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	// The address is kept with the operation
+	struct Op* op = proactorNewOp(OP_CONNECT,fd,addr_len,pt,fn,param,param_len);
+	if (!op)
+		return -1;
+
+	op->m_buf = op + 1;
+	op->m_len = addr_len;
+	memcpy(op->m_buf,addr,addr_len);
+	return proactorSendOp(ph,op);
+}
+
+static void proactorSendBuffer(enum ProactorCommands op_code, struct BufferPool* pool, unsigned int id)
+{
+	_Alignas(16) unsigned char msg[32] = { op_code };
+	unsigned char* p = msg + 2;
+
+	WRITE_ARG(pool,p);
+	WRITE_ARG(id,p);
+
+	msg[1] = (p - msg);
+	assert(p - msg <= sizeof(msg));
+	proactorWriteControl(pool->m_proactor,msg);
+}
+
+static void proactorAddBuffers(struct Proactor* pr, struct BufferPool* pool)
+{
+#if defined(PROACTOR_URING)
+	if (pr->m_uring.m_fd != -1)
+	{
+		pool->m_group = pr->m_next_buffer_group++;
+		proactorProvideBuffers(pr,pool,0,pool->m_count);
+	}
+#endif
+}
+
+static void proactorReturnBuffer(struct Proactor* pr, struct BufferPool* pool, unsigned int id)
+{
+#if defined(PROACTOR_URING)
+	if (pr->m_uring.m_fd != -1)
+	{
+		proactorProvideBuffers(pr,pool,id,1);
+		return;
+	}
+#endif
+	assert(pool->m_free_count < pool->m_count);
+	pool->m_free[pool->m_free_count++] = id;
+}
+
+static void proactorRemoveBuffers(struct Proactor* pr, struct BufferPool* pool)
+{
+#if defined(PROACTOR_URING)
+	if (pr->m_uring.m_fd != -1)
+	{
+		struct io_uring_sqe* sqe = proactorGetSqe(pr);
+		sqe->opcode = IORING_OP_REMOVE_BUFFERS;
+		sqe->fd = pool->m_count;
+		sqe->buf_group = pool->m_group;
+	}
+#endif
+	free(pool->m_free);
+	free(pool);
+}
+
+proactor_buffers_t proactor_create_buffers(proactor_t ph, void* base, size_t size, unsigned int count)
+{
+	// io_uring buffer ids are 16 bits
+	if (!ph || !base || !size || size > INT32_MAX || !count || count > 65536)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct BufferPool* pool = malloc(sizeof(struct BufferPool));
+	if (!pool)
+		abort();
+
+	pool->m_proactor = (struct Proactor*)ph;
+	pool->m_base = base;
+	pool->m_size = size;
+	pool->m_count = count;
+	pool->m_group = 0;
+	pool->m_free = malloc(count * sizeof(unsigned int));
+	if (!pool->m_free)
+		abort();
+
+	// Handed out from the end, so the lowest ids go first
+	for (unsigned int i = 0; i < count; ++i)
+		pool->m_free[i] = count - 1 - i;
+	pool->m_free_count = count;
+
+	proactorSendBuffer(CMD_ADD_BUFFERS,pool,0);
+	return (proactor_buffers_t)pool;
+}
+
+void proactor_destroy_buffers(proactor_buffers_t ph)
+{
+	if (ph)
+		proactorSendBuffer(CMD_REMOVE_BUFFERS,(struct BufferPool*)ph,0);
+}
+
+void* proactor_buffer(proactor_buffers_t ph, unsigned int buffer_id)
+{
+	struct BufferPool* pool = (struct BufferPool*)ph;
+	assert(buffer_id < pool->m_count);
+	return pool->m_base + buffer_id * pool->m_size;
+}
+
+void proactor_return_buffer(proactor_buffers_t ph, unsigned int buffer_id)
+{
+	struct BufferPool* pool = (struct BufferPool*)ph;
+	assert(buffer_id < pool->m_count);
+	proactorSendBuffer(CMD_RETURN_BUFFER,pool,buffer_id);
+}
+
+int proactor_recv_buffer(proactor_t ph, socket_t fd, proactor_buffers_t buffers, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (!buffers)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct Op* op = proactorNewOp(OP_RECV_BUFFER,fd,0,pt,fn,param,param_len);
+	if (!op)
+		return -1;
+
+	op->m_buf = buffers;
+	op->m_len = ((struct BufferPool*)buffers)->m_size;
+	return proactorSendOp(ph,op);
+}
+
+// Held commands for fd are dropped, with any operations completed as cancelled
+static void proactorCancelHeld(struct Proactor* pr, socket_t fd)
+{
+	struct HeldCommand** prev = &pr->m_held;
+	pr->m_held_tail = NULL;
+	while (*prev)
+	{
+		struct HeldCommand* h = *prev;
+		if (h->m_fd != fd)
+		{
+			pr->m_held_tail = h;
+			prev = &h->m_next;
+			continue;
+		}
+
+		if (h->m_msg[0] == CMD_ADD_OP)
+		{
+			unsigned char* pp = h->m_msg + 2;
+			struct Op* op;
+			READ_ARG(op,pp);
+			proactorCompleteOp(op,ECANCELED,0,-1);
+		}
+		*prev = h->m_next;
+		free(h);
+	}
+}
+
+static void proactorCancelWatcher(struct Proactor* pr, unsigned char* p, unsigned int flags)
+{
+	socket_t fd;
+	READ_ARG(fd,p);
+
+	if ((flags & POLL_EVENT_RD) && pr->m_held)
+		proactorCancelHeld(pr,fd);
+
+	for (size_t i = 0; (flags & POLL_EVENT_WR) && i < pr->m_send_count; ++i)
+	{
+		if (pr->m_sends[i]->m_fd == fd)
+		{
+			proactorFailOps(pr->m_sends[i],ECANCELED);
+			pr->m_sends[i] = pr->m_sends[--pr->m_send_count];
+			break;
+		}
+	}
+
+	struct Watcher* watcher = proactorFindWatcher(pr,fd,flags);
+	if (watcher)
+	{
+		if (watcher->m_ops)
+			proactorCancelOps(pr,watcher);
+
+		if (watcher->m_timer)
+		{
+			proactorRemoveTimer(pr,watcher->m_timer);
+			watcher->m_timer = NULL;
+		}
+
+		proactorDisarm(pr,fd,flags);
+	}
+#if defined(PROACTOR_URING)
+	else if (pr->m_uring.m_fd != -1 && (size_t)fd < pr->m_fd_alloc_size)
+	{
+		// io_uring operations are in flight without arming anything
+		watcher = pr->m_fds[fd].m_watchers[(flags & POLL_EVENT_WR) ? 1 : 0];
+		if (watcher)
+			proactorCancelOps(pr,watcher);
+	}
+#endif
+}
+
+static void proactorSendCancelWatcher(enum ProactorCommands op_code, proactor_t ph, socket_t fd)
+{
+	struct Proactor* pr = (struct Proactor*)ph;
+
+	_Alignas(16) unsigned char msg[32] = { op_code };
+	unsigned char* p = msg + 2;
+
+	WRITE_ARG(fd,p);
+
+	msg[1] = (p - msg);
+	assert(p - msg <= sizeof(msg));
+	proactorWriteControl(pr,msg);
+}
+
+void proactor_cancel_recv_watcher(proactor_t ph, socket_t fd)
+{
+	proactorSendCancelWatcher(CMD_CANCEL_RECV_WATCHER,ph,fd);
+}
+
+void proactor_cancel_send_watcher(proactor_t ph, socket_t fd)
+{
+	proactorSendCancelWatcher(CMD_CANCEL_SEND_WATCHER,ph,fd);
+}
+
+static void proactorClearWake(struct Proactor* pr)
+{
+	unsigned char buf[64];
+#if defined(_WIN32)
+	while (recv(pr->m_control_recv_fd,buf,sizeof(buf),0) > 0)
+		;
+#else
+	ssize_t r;
+	do
+		r = read(pr->m_control_recv_fd,buf,sizeof(buf));
+	while (r > 0 || (r == -1 && errno == EINTR));
+#endif
+}
+
+static void proactorCommand(struct Proactor* pr, unsigned char* msg)
+{
+	switch (msg[0])
+	{
+	case CMD_ADD_TIMER:
+		proactorAddTimer(pr,msg + 2);
+		break;
+
+	case CMD_CANCEL_TIMER:
+		proactorCancelTimer(pr,msg + 2);
+		break;
+
+	case CMD_UPDATE_TIMER:
+		proactorUpdateTimer(pr,msg + 2);
+		break;
+
+	case CMD_ADD_RECV_WATCHER:
+		{
+			unsigned char* pp = msg + 2;
+			proactorAddWatcher(pr,&pp,POLL_EVENT_RD,0);
+			break;
+		}
+
+	case CMD_ADD_RECV_P_WATCHER:
+		{
+			unsigned char* pp = msg + 2;
+			unsigned int mode;
+			READ_ARG(mode,pp);
+			proactorAddWatcher(pr,&pp,POLL_EVENT_RD,mode);
+			break;
+		}
+
+	case CMD_ADD_RECV_T_WATCHER:
+		proactorAddTimedWatcher(pr,msg + 2,POLL_EVENT_RD);
+		break;
+
+	case CMD_CANCEL_RECV_WATCHER:
+		proactorCancelWatcher(pr,msg + 2,POLL_EVENT_RD);
+		break;
+
+	case CMD_ADD_SEND_WATCHER:
+		{
+			unsigned char* pp = msg + 2;
+			proactorAddWatcher(pr,&pp,POLL_EVENT_WR,0);
+			break;
+		}
+
+	case CMD_ADD_SEND_P_WATCHER:
+		{
+			unsigned char* pp = msg + 2;
+			unsigned int mode;
+			READ_ARG(mode,pp);
+			proactorAddWatcher(pr,&pp,POLL_EVENT_WR,mode);
+			break;
+		}
+
+	case CMD_ADD_SEND_T_WATCHER:
+		proactorAddTimedWatcher(pr,msg + 2,POLL_EVENT_WR);
+		break;
+
+	case CMD_CANCEL_SEND_WATCHER:
+		proactorCancelWatcher(pr,msg + 2,POLL_EVENT_WR);
+		break;
+
+	case CMD_ADD_OP:
+		proactorAddOp(pr,msg + 2);
+		break;
+
+	case CMD_ADD_BUFFERS:
+	case CMD_RETURN_BUFFER:
+	case CMD_REMOVE_BUFFERS:
+		{
+			unsigned char* pp = msg + 2;
+			struct BufferPool* pool;
+			unsigned int id;
+			READ_ARG(pool,pp);
+			READ_ARG(id,pp);
+			if (msg[0] == CMD_ADD_BUFFERS)
+				proactorAddBuffers(pr,pool);
+			else if (msg[0] == CMD_RETURN_BUFFER)
+				proactorReturnBuffer(pr,pool,id);
+			else
+				proactorRemoveBuffers(pr,pool);
+			break;
+		}
+
+#if !defined(_WIN32)
+	case CMD_FILE_DONE:
+		{
+			unsigned char* pp = msg + 2;
+			struct Op* op;
+			READ_ARG(op,pp);
+			proactorRunOp(op);
+			proactorFileDone(pr);
+			break;
+		}
+#endif
+
+	case CMD_EXIT:
+		proactorFlushSends(pr);
+#if !defined(PROACTOR_EPOLL)
+		assert(pr->m_n_poll_fds == 1);
+		pr->m_n_poll_fds = 0;
+#endif
+		pr->m_running = 0;
+		break;
+
+	default:
+		abort();
+	}
+}
+
+// Returns non-zero if msg arms a recv watcher or operation, which has been held back until the workers catch up
+static int proactorHoldCommand(struct Proactor* pr, const unsigned char* msg)
+{
+	socket_t fd;
+	unsigned char* p = (unsigned char*)msg + 2;
+	switch (msg[0])
+	{
+	case CMD_ADD_RECV_P_WATCHER:
+		{
+			unsigned int mode;
+			READ_ARG(mode,p);
+			(void)mode;
+			READ_ARG(fd,p);
+			break;
+		}
+
+	case CMD_ADD_RECV_WATCHER:
+	case CMD_ADD_RECV_T_WATCHER:
+		READ_ARG(fd,p);
+		break;
+
+	case CMD_ADD_OP:
+		{
+			struct Op* op;
+			READ_ARG(op,p);
+			if (op->m_type != OP_RECV && op->m_type != OP_ACCEPT && op->m_type != OP_RECV_BUFFER && op->m_type != OP_RECV_DATAGRAMS)
+				return 0;
+
+			fd = op->m_fd;
+			break;
+		}
+
+	default:
+		return 0;
+	}
+
+	struct HeldCommand* h = malloc(sizeof(struct HeldCommand) + msg[1]);
+	if (!h)
+		abort();
+
+	h->m_next = NULL;
+	h->m_fd = fd;
+	memcpy(h->m_msg,msg,msg[1]);
+	if (pr->m_held_tail)
+		pr->m_held_tail->m_next = h;
+	else
+		pr->m_held = h;
+	pr->m_held_tail = h;
+
+	atomic_fetch_add_explicit(&pr->m_shed,1,memory_order_relaxed);
+	return 1;
+}
+
+static void proactorReadControl(struct Proactor* pr)
+{
+	// Drain in batches, so a burst of commands costs one claim of the ring per batch
+	_Alignas(16) unsigned char msgs[CONTROL_BATCH][CONTROL_MSG_SIZE];
+	size_t count, total = 0;
+	while ((count = ringRecv(&pr->m_commands,msgs,CONTROL_BATCH)) != 0)
+	{
+		total += count;
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (!pr->m_overloaded || !proactorHoldCommand(pr,msgs[i]))
+				proactorCommand(pr,msgs[i]);
+		}
+
+		if (pr->m_send_count)
+			proactorFlushSends(pr);
+	}
+
+	if (total && pr->m_turn_stats)
+		statsRecord(&pr->m_turn_stats->m_commands_per_read,total);
+}
+
+// Once a turn, before any new commands, so held ones are replayed in the order they came
+static void proactorCheckLoad(struct Proactor* pr)
+{
+	size_t high = atomic_load_explicit(&pr->m_high_water,memory_order_relaxed);
+	if (!high && !pr->m_overloaded)
+		return;
+
+	size_t depth = task_queue_depth() + (pr->m_overflow ? pr->m_overflow->m_count : 0);
+	atomic_store_explicit(&pr->m_queue_depth,depth,memory_order_relaxed);
+	if (!pr->m_overloaded)
+	{
+		if (depth > high)
+		{
+			pr->m_overloaded = 1;
+			atomic_fetch_add_explicit(&pr->m_overloads,1,memory_order_relaxed);
+		}
+		return;
+	}
+
+	if (high && depth > atomic_load_explicit(&pr->m_low_water,memory_order_relaxed))
+		return;
+
+	pr->m_overloaded = 0;
+	struct HeldCommand* h = pr->m_held;
+	pr->m_held = pr->m_held_tail = NULL;
+	while (h)
+	{
+		struct HeldCommand* next = h->m_next;
+		proactorCommand(pr,h->m_msg);
+		free(h);
+		h = next;
+	}
+
+	if (pr->m_send_count)
+		proactorFlushSends(pr);
+}
+
+struct DispatchRange
+{
+	struct DispatchBatch* m_batch;
+	size_t                m_begin;
+	size_t                m_end;
+};
+
+static void proactorReleaseBatch(struct DispatchBatch* b, size_t count)
+{
+	if (atomic_fetch_sub_explicit(&b->m_pending,count,memory_order_acq_rel) == count)
+		free(b);
+}
+
+static void proactorSplitRun(task_t task, struct Dispatch* d)
+{
+	// A callback with a parent needs a task of its own, for the parent to wait on
+	if (d->m_parent && task_try_run(d->m_parent,d->m_fn,d->m_param,d->m_param_len))
+		return;
+
+	// Otherwise it runs here, and with the pool full the parent is held open as if it were its child
+	int retained = (d->m_parent && task_retain(d->m_parent) == 0);
+	(*d->m_fn)(task,d->m_param);
+	if (retained)
+		task_release(d->m_parent);
+}
+
+static void proactorSplitDispatch(task_t task, void* param)
+{
+	struct DispatchRange r = *(struct DispatchRange*)param;
+
+	// The first splitter lets the proactor know it can hand out the next batch
+	if (!r.m_begin)
+		atomic_store_explicit(&r.m_batch->m_taken,1,memory_order_release);
+
+	// Hand off the upper half until the range is small, so the events spread over the workers that steal them
+	// Waiting for room in a full pool would run other tasks nested in this one, so then the rest of the range runs here
+	while (r.m_end - r.m_begin > DISPATCH_GRAIN)
+	{
+		struct DispatchRange right = r;
+		right.m_begin = r.m_begin + (r.m_end - r.m_begin) / 2;
+		if (!task_try_run(NULL,&proactorSplitDispatch,&right,sizeof(right)))
+			break;
+
+		r.m_end = right.m_begin;
+	}
+
+	for (size_t i = r.m_begin; i < r.m_end; ++i)
+		proactorSplitRun(task,&r.m_batch->m_entries[i]);
+
+	proactorReleaseBatch(r.m_batch,r.m_end - r.m_begin);
+}
+
+static void proactorAppendDispatch(struct DispatchBatch** pb, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	struct DispatchBatch* b = *pb;
+	if (!b || b->m_count == b->m_alloc_size)
+	{
+		size_t alloc_size = b ? b->m_alloc_size * 2 : DISPATCH_CHUNK;
+		b = realloc(b,sizeof(struct DispatchBatch) + alloc_size * sizeof(struct Dispatch));
+		if (!b)
+			abort();
+
+		if (!*pb)
+			b->m_count = 0;
+		b->m_alloc_size = alloc_size;
+		*pb = b;
+	}
+
+	struct Dispatch* d = &b->m_entries[b->m_count++];
+	d->m_parent = pt;
+	d->m_fn = fn;
+	d->m_param_len = param_len;
+	if (param_len)
+		memcpy(d->m_param,param,param_len);
+}
+
+// Never runs other tasks to make room, as task_run() would, holding up every fd and timer while it did
+// With the pool full, fn waits in the overflow list behind anything already there
+static void proactorRunTask(struct Proactor* pr, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (!pr->m_overflow || !pr->m_overflow->m_count)
+	{
+		if (task_try_run(pt,fn,param,param_len) || errno != EAGAIN)
+			return;
+	}
+
+	proactorAppendDispatch(&pr->m_overflow,pt,fn,param,param_len);
+	atomic_fetch_add_explicit(&pr->m_deferred,1,memory_order_relaxed);
+}
+
+// As much of the overflow as the pool has room for, or all of it if wait is set and the loop can afford to help out
+static void proactorFlushOverflow(struct Proactor* pr, int wait)
+{
+	struct DispatchBatch* b = pr->m_overflow;
+	if (!b || !b->m_count)
+		return;
+
+	size_t i = 0;
+	for (; i < b->m_count; ++i)
+	{
+		struct Dispatch* d = &b->m_entries[i];
+		if (wait)
+			task_run(d->m_parent,d->m_fn,d->m_param,d->m_param_len);
+		else if (!task_try_run(d->m_parent,d->m_fn,d->m_param,d->m_param_len) && errno == EAGAIN)
+			break;
+	}
+
+	b->m_count -= i;
+	memmove(b->m_entries,b->m_entries + i,b->m_count * sizeof(struct Dispatch));
+}
+
+// Runs fn as a task, or holds it until proactorFlushDispatch() to run inline or in a batch
+static void proactorDispatch(struct Proactor* pr, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	struct StatsCall sc;
+	fn = proactorStatsWrap(pr,fn,&param,&param_len,&sc);
+
+	// A callback with a parent needs a task of its own, for the parent to wait on
+	if (!pt && (atomic_load_explicit(&pr->m_busy_poll_flags,memory_order_relaxed) & PROACTOR_BUSY_POLL_INLINE))
+		proactorAppendDispatch(&pr->m_inline,pt,fn,param,param_len);
+	else if (!atomic_load_explicit(&pr->m_batch_dispatch,memory_order_relaxed) || (pr->m_batch && pr->m_batch->m_count >= DISPATCH_MAX))
+		proactorRunTask(pr,pt,fn,param,param_len);
+	else
+		proactorAppendDispatch(&pr->m_batch,pt,fn,param,param_len);
+}
+
+// Busy polling with inline callbacks: they run here, on the loop, so there is no handing off to a worker
+// Anything they do to the proactor is handled by the next turn of the loop, as it would be from any other thread
+static void proactorRunInline(struct Proactor* pr)
+{
+	struct DispatchBatch* b;
+	while ((b = pr->m_inline) != NULL && b->m_count)
+	{
+		// Room for more while these run, if a full command ring has to be drained under them
+		pr->m_inline = NULL;
+		s_inline_proactor = pr;
+		for (size_t i = 0; i < b->m_count; ++i)
+			(*b->m_entries[i].m_fn)(pr->m_task,b->m_entries[i].m_param);
+		s_inline_proactor = NULL;
+
+		b->m_count = 0;
+		if (pr->m_inline)
+			free(b);
+		else
+			pr->m_inline = b;
+	}
+}
+
+// One task for the whole batch, so the loop isn't held up allocating a task per event
+// Only one batch waits for a worker at a time: if the proactor's own task pool filled with splitters, it would end up
+// running them nested inside task_run(), each waiting on the pool for its children
+static void proactorFlushDispatch(struct Proactor* pr)
+{
+	proactorFlushOverflow(pr,0);
+	proactorRunInline(pr);
+
+	struct DispatchBatch* b = pr->m_batch;
+	if (!b || !b->m_count)
+		return;
+
+	if (pr->m_dispatched)
+	{
+		if (pr->m_running && !atomic_load_explicit(&pr->m_dispatched->m_taken,memory_order_acquire))
+			return;
+
+		proactorReleaseBatch(pr->m_dispatched,1);
+		pr->m_dispatched = NULL;
+	}
+
+	if (b->m_count == 1)
+	{
+		// Nothing to share out, and the batch can be used again
+		proactorRunTask(pr,b->m_entries[0].m_parent,b->m_entries[0].m_fn,b->m_entries[0].m_param,b->m_entries[0].m_param_len);
+		b->m_count = 0;
+		return;
+	}
+
+	// The proactor holds on to it too, to see when it is taken
+	atomic_init(&b->m_pending,b->m_count + 1);
+	atomic_init(&b->m_taken,0);
+	struct DispatchRange r = { b, 0, b->m_count };
+	if (!(pr->m_running ? task_try_run(NULL,&proactorSplitDispatch,&r,sizeof(r)) : task_run(NULL,&proactorSplitDispatch,&r,sizeof(r))))
+	{
+		// With the pool full the batch waits for the next turn
+		if (errno != EAGAIN)
+			abort();
+		return;
+	}
+
+	pr->m_batch = NULL;
+	pr->m_dispatched = b;
+}
+
+// Returns non-zero if the watcher is still armed
+static int proactorFire(struct Proactor* pr, struct Watcher* w)
+{
+	if (w->m_ops)
+		return proactorReadyOps(w);
+
+	proactorDispatch(pr,w->m_parent,w->m_fn,w->m_param,w->m_param_len);
+
+	if (w->m_mode & WATCHER_PERSISTENT)
+		return 1;
+
+	if (w->m_timer)
+	{
+		proactorRemoveTimer(pr,w->m_timer);
+		w->m_timer = NULL;
+	}
+	return 0;
+}
+
+// Time asleep, only for waits that could sleep, and how many fds woke it
+static void proactorWaited(struct Proactor* pr, uint64_t start, int ready)
+{
+	struct ProactorStats* s = pr->m_turn_stats;
+	if (!s)
+		return;
+
+	if (start)
+	{
+		uint64_t waited = timeNow() - start;
+		pr->m_waited += waited;
+		statsRecord(&s->m_wait_ns,waited);
+	}
+	if (ready > 0)
+		statsRecord(&s->m_ready_fds,(uint64_t)ready);
+}
+
+#if defined(PROACTOR_EPOLL)
+// A precise deadline is waited for with the timerfd, which is only re-armed when the deadline changes
+// Returns the number of fds that were ready
+static int proactorWait(struct Proactor* pr, int timeout, uint64_t precise_deadline)
+{
+#if defined(PROACTOR_URING)
+	// Everything queued since the last wait goes to the kernel in one syscall
+	if (pr->m_uring.m_fd != -1)
+		uringSubmit(&pr->m_uring);
+#endif
+
+	if (precise_deadline && pr->m_timer_fd != -1)
+	{
+		if (precise_deadline != pr->m_timer_fd_deadline)
+		{
+			struct itimerspec its = { .it_value = { precise_deadline / 1000000000, precise_deadline % 1000000000 } };
+			if (timerfd_settime(pr->m_timer_fd,TFD_TIMER_ABSTIME,&its,NULL) != 0)
+				abort();
+
+			pr->m_timer_fd_deadline = precise_deadline;
+		}
+		timeout = -1;
+	}
+
+	uint64_t start = (pr->m_turn_stats && timeout) ? timeNow() : 0;
+	int ret;
+	do
+		ret = epoll_wait(pr->m_epoll_fd,pr->m_events,EPOLL_BATCH,timeout);
+	while (ret == -1 && errno == EINTR);
+
+	if (ret == -1)
+		abort();
+
+	proactorWaited(pr,start,ret);
+
+	// Only the ready fds, however many are being watched
+	for (int i = 0; i < ret; ++i)
+	{
+		socket_t fd = pr->m_events[i].data.fd;
+		if (fd == pr->m_control_recv_fd)
+		{
+			// Commands are drained on every loop, just clear the wakeup
+			proactorClearWake(pr);
+			continue;
+		}
+
+		if (fd == pr->m_timer_fd)
+		{
+			// The timers are checked on every loop, just clear it
+			uint64_t expirations;
+			if (read(pr->m_timer_fd,&expirations,sizeof(expirations)) == sizeof(expirations))
+				pr->m_timer_fd_deadline = 0;
+			continue;
+		}
+
+#if defined(PROACTOR_URING)
+		if (fd == pr->m_uring.m_fd)
+		{
+			proactorReapUring(pr);
+			continue;
+		}
+#endif
+
+		// The control messages may have changed things since the wait returned
+		struct FdEntry* e = &pr->m_fds[fd];
+		uint32_t revents = pr->m_events[i].events;
+		uint32_t fired = 0;
+
+		if ((e->m_events & POLL_EVENT_RD) && (revents & (EPOLLERR | EPOLLHUP | POLL_EVENT_RD)) && !proactorFire(pr,e->m_watchers[0]))
+			fired |= POLL_EVENT_RD;
+
+		if ((e->m_events & POLL_EVENT_WR) && (revents & (EPOLLERR | EPOLLHUP | POLL_EVENT_WR)) && !proactorFire(pr,e->m_watchers[1]))
+			fired |= POLL_EVENT_WR;
+
+		// EPOLLONESHOT has disabled the fd, so re-arm whatever is still wanted
+		// A persistent registration is still armed, and only needs changing if a one-shot watcher fired
+		e->m_events &= ~fired;
+		proactorReleaseWatchers(pr,e->m_watchers,fired);
+		if ((e->m_armed & EPOLLONESHOT) ? e->m_events != 0 : fired != 0)
+			proactorEpollArm(pr,fd,e);
+	}
+	return ret;
+}
+#else
+#if defined(__linux__)
+// ppoll() takes a timespec, so a precise deadline doesn't get rounded to milliseconds
+static int proactorPollOnce(struct Proactor* pr, nfds_t nfds, int timeout, uint64_t precise_deadline)
+{
+	if (!precise_deadline)
+		return poll(pr->m_poll_fds,nfds,timeout);
+
+	uint64_t tNow = timeNow();
+	uint64_t delay = precise_deadline > tNow ? precise_deadline - tNow : 0;
+	struct timespec ts = { delay / 1000000000, delay % 1000000000 };
+	return ppoll(pr->m_poll_fds,nfds,&ts,NULL);
+}
+#else
+#define proactorPollOnce(pr,nfds,timeout,precise_deadline) poll((pr)->m_poll_fds,nfds,timeout)
+#endif
+
+static int proactorPoll(struct Proactor* pr, int timeout, uint64_t precise_deadline)
+{
+	int ret;
+#if defined(_WIN32)
+	ret = WSAPoll(pr->m_poll_fds,pr->m_n_poll_fds,timeout);
+	if (ret == -1 && WSAGetLastError() == WSAENOBUFS)
+		ret = WSAPoll(pr->m_poll_fds,pr->m_n_poll_fds / 2,timeout);
+#else
+	do
+		ret = proactorPollOnce(pr,pr->m_n_poll_fds,timeout,precise_deadline);
+	while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+
+	if (ret == -1 && errno == ENOMEM)
+	{
+		do
+			ret = proactorPollOnce(pr,pr->m_n_poll_fds / 2,timeout,precise_deadline);
+		while (ret == -1 && (errno == EINTR || errno == EAGAIN));
+	}
+#endif
+	if (ret == -1)
+		abort();
+
+	return ret;
+}
+
+static int proactorWait(struct Proactor* pr, int timeout, uint64_t precise_deadline)
+{
+	uint64_t start = (pr->m_turn_stats && (timeout || precise_deadline)) ? timeNow() : 0;
+	int ret = proactorPoll(pr,timeout,precise_deadline);
+	proactorWaited(pr,start,ret);
+	int fds = ret;
+
+	// Check watchers
+	for (nfds_t i = 0; i < pr->m_n_poll_fds && fds > 0; ++i)
+	{
+		if (pr->m_poll_fds[i].revents)
+		{
+			--fds;
+			if (i == 0)
+			{
+				// Commands are drained on every loop, just clear the wakeup
+				proactorClearWake(pr);
+				continue;
+			}
+
+			struct Watcher** watchers = &pr->m_watchers[i*2];
+			unsigned int fired = 0;
+			if ((pr->m_poll_fds[i].events & POLL_EVENT_RD) && (pr->m_poll_fds[i].revents & (POLLERR | POLLHUP | POLL_EVENT_RD)) && !proactorFire(pr,watchers[0]))
+				fired |= POLL_EVENT_RD;
+
+			if ((pr->m_poll_fds[i].events & POLL_EVENT_WR) && (pr->m_poll_fds[i].revents & (POLLERR | POLLHUP | POLL_EVENT_WR)) && !proactorFire(pr,watchers[1]))
+				fired |= POLL_EVENT_WR;
+
+			pr->m_poll_fds[i].events &= ~fired;
+			proactorReleaseWatchers(pr,watchers,fired);
+
+			if (!pr->m_poll_fds[i].events)
+			{
+				proactorRemoveWatcher(pr,i);
+
+				// Check i again
+				--i;
+			}
+		}
+	}
+	return ret;
+}
+#endif
+
+static void proactorExpireTimer(struct Proactor* pr, struct Timer* t, uint64_t tNow)
+{
+	if (t->m_flags)
+	{
+		// A timed watcher has timed out, so it is no longer watching
+		struct Watcher* w = proactorFindWatcher(pr,t->m_fd,t->m_flags);
+		if (w)
+		{
+			w->m_timer = NULL;
+			proactorDispatch(pr,t->m_parent,t->m_fn,w->m_param,w->m_param_len);
+			proactorDisarm(pr,t->m_fd,t->m_flags);
+		}
+		proactorRemoveTimer(pr,t);
+		return;
+	}
+
+	proactorDispatch(pr,t->m_parent,t->m_fn,timerParam(t),t->m_param_len);
+
+	if (t->m_repeat != 0)
+		proactorRescheduleTimer(pr,t,timerCoalesce(tNow + t->m_repeat,t->m_slack));
+	else
+		proactorRemoveTimer(pr,t);
+}
+
+// One turn of the event loop, which only waits if block is set
+static void proactorTurn(struct Proactor* pr, int block)
+{
+	proactorCheckLoad(pr);
+	proactorReadControl(pr);
+	if (!pr->m_running)
+	{
+		proactorFlushDispatch(pr);
+		proactorFlushOverflow(pr,1);
+		return;
+	}
+
+	// Fire off expired timers, earliest first
+	uint64_t tNow = timeNow();
+	while (pr->m_timer_count && pr->m_timer_heap[0].m_deadline <= tNow)
+	{
+		if (pr->m_turn_stats)
+			statsRecord(&pr->m_turn_stats->m_timer_late_ns,tNow - pr->m_timer_heap[0].m_deadline);
+		proactorExpireTimer(pr,pr->m_timer_heap[0].m_timer,tNow);
+	}
+
+	proactorFlushDispatch(pr);
+
+	// Poll, in whole milliseconds rounded up so the wait never ends early
+	int timeout = -1;
+	uint64_t precise_deadline = 0;
+	if (pr->m_timer_count)
+	{
+		uint64_t delay = (pr->m_timer_heap[0].m_deadline - tNow + 999999) / 1000000;
+		timeout = delay > INT_MAX ? INT_MAX : (int)delay;
+
+		if (pr->m_timer_heap[0].m_timer->m_precise)
+			precise_deadline = pr->m_timer_heap[0].m_deadline;
+	}
+
+	if (!block)
+	{
+		proactorWait(pr,0,0);
+		proactorFlushDispatch(pr);
+		return;
+	}
+
+	// Busy polling: until the budget since the last event runs out, look again rather than sleep
+	uint64_t busy_poll = atomic_load_explicit(&pr->m_busy_poll_ns,memory_order_relaxed);
+	if (busy_poll && tNow < pr->m_busy_until)
+	{
+		if (proactorWait(pr,0,0))
+			pr->m_busy_until = timeNow() + busy_poll;
+		proactorFlushDispatch(pr);
+		return;
+	}
+
+	// Events held back for a batch that hasn't been taken yet, or for room in the pool, can't wait for the next wakeup
+	// Give the workers the CPU to take them, and look for more in the meantime
+	if ((pr->m_batch && pr->m_batch->m_count) || (pr->m_overflow && pr->m_overflow->m_count))
+	{
+		thrd_yield();
+		proactorWait(pr,0,0);
+		proactorFlushDispatch(pr);
+		return;
+	}
+
+	// Nothing tells us when the workers have caught up, so held commands are checked for every millisecond
+	if (pr->m_overloaded && (timeout < 0 || timeout > 1))
+		timeout = 1;
+
+	// Tell writers to wake us, then look again in case a command slipped in before they could see it
+	atomic_store(&pr->m_sleeping,1);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!ringEmpty(&pr->m_commands))
+	{
+		timeout = 0;
+		precise_deadline = 0;
+	}
+
+	proactorWait(pr,timeout,precise_deadline);
+	atomic_store_explicit(&pr->m_sleeping,0,memory_order_relaxed);
+	if (busy_poll)
+		pr->m_busy_until = timeNow() + busy_poll;
+	proactorFlushDispatch(pr);
+}
+
+// With stats off this is all it costs
+static void proactorLoopOnce(struct Proactor* pr, int block)
+{
+	struct ProactorStats* s = atomic_load_explicit(&pr->m_stats,memory_order_acquire);
+	pr->m_turn_stats = s;
+	if (!s)
+	{
+		proactorTurn(pr,block);
+		return;
+	}
+
+	uint64_t start = timeNow();
+	pr->m_waited = 0;
+	proactorTurn(pr,block);
+	statsRecord(&s->m_loop_ns,timeNow() - start - pr->m_waited);
+	atomic_store_explicit(&s->m_timers,pr->m_timer_count,memory_order_relaxed);
+	atomic_store_explicit(&s->m_watchers,pr->m_watcher_count,memory_order_relaxed);
+}
+
+static void proactorRun(task_t task, void* param)
+{
+	for (struct Proactor* pr = *(struct Proactor* const*)param; pr->m_running; )
+		proactorLoopOnce(pr,1);
+}
+
+static void proactorIdlePoll(void* param, int block)
+{
+	struct Proactor* pr = param;
+	if (pr->m_running)
+		proactorLoopOnce(pr,block);
+}
+
+static void proactorIdleWake(void* param)
+{
+	proactorWake(param);
+}
+
+static int proactorWakePair(socket_t* fd1, socket_t* fd2)
+{
+	int err = 0;
+#if defined(_WIN32)
+	// TODO: Use a loopback TCP socket
+#elif defined(__linux__)
+	// One eventfd is both ends
+	*fd1 = *fd2 = eventfd(0,EFD_NONBLOCK | EFD_CLOEXEC);
+	if (*fd1 == -1)
+		err = errno;
+#else
+	int fds[2] = {-1, -1};
+	err = pipe(fds);
+	for (int i = 0; !err && i < 2; ++i)
+	{
+		int flags = fcntl(fds[i], F_GETFL, 0);
+		if (flags == -1 || fcntl(fds[i], F_SETFL, flags | O_NONBLOCK) == -1 || fcntl(fds[i], F_SETFD, FD_CLOEXEC) == -1)
+			err = errno;
+	}
+
+	if (err)
+	{
+		closesocket(fds[0]);
+		closesocket(fds[1]);
+	}
+	else
+	{
+		*fd1 = fds[1];
+		*fd2 = fds[0];
+	}
+#endif
+	return err;
+}
+
+static struct Proactor* proactorCreate()
+{
+	struct Proactor* pr = malloc(sizeof(struct Proactor));
 	if (!pr)
 		abort();
 
 	pr->m_task = NULL;
+	pr->m_scheduler = NULL;
+	pr->m_stopping = 0;
 	pr->m_timer_alloc_size = 0;
-	pr->m_timers = NULL;
+	pr->m_timer_heap = NULL;
 	pr->m_timer_count = 0;
-	pr->m_control_offset = 0;
+	pr->m_timer_hash = NULL;
+	pr->m_timer_hash_mask = 0;
+	pr->m_free_timers = NULL;
+	pr->m_timer_chunks = NULL;
+	pr->m_free_watchers[0] = pr->m_free_watchers[1] = NULL;
+	pr->m_watcher_chunks = NULL;
+	pr->m_next_buffer_group = 0;
+	pr->m_send_count = 0;
+#if !defined(_WIN32)
+	pr->m_file_thread_count = 0;
+	pr->m_file_inflight = 0;
+	pr->m_file_backlog = pr->m_file_backlog_tail = NULL;
+#endif
+	atomic_init(&pr->m_batch_dispatch,0);
+	pr->m_batch = pr->m_dispatched = NULL;
+	pr->m_running = 1;
+	pr->m_overflow = NULL;
+	atomic_init(&pr->m_high_water,0);
+	atomic_init(&pr->m_low_water,0);
+	pr->m_overloaded = 0;
+	pr->m_held = pr->m_held_tail = NULL;
+	atomic_init(&pr->m_queue_depth,0);
+	atomic_init(&pr->m_overloads,0);
+	atomic_init(&pr->m_shed,0);
+	atomic_init(&pr->m_deferred,0);
+	atomic_init(&pr->m_busy_poll_ns,0);
+	atomic_init(&pr->m_busy_poll_flags,0);
+	pr->m_busy_until = 0;
+	pr->m_inline = NULL;
+	atomic_init(&pr->m_stats,NULL);
+	atomic_init(&pr->m_stats_alloc,NULL);
+	pr->m_turn_stats = NULL;
+	pr->m_waited = 0;
+	pr->m_watcher_count = 0;
+	ringInit(&pr->m_commands,CONTROL_RING_SIZE,CONTROL_MSG_SIZE);
+	atomic_init(&pr->m_sleeping,0);
 	atomic_store(&pr->m_next_timer_id,1);
 
+	// Create the wakeup fds
+	if (proactorWakePair(&pr->m_control_fd,&pr->m_control_recv_fd) != 0)
+		abort();
+
+#if defined(PROACTOR_EPOLL)
+	pr->m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (pr->m_epoll_fd == -1)
+		abort();
+
+	pr->m_fd_alloc_size = 64;
+	pr->m_fds = calloc(pr->m_fd_alloc_size,sizeof(struct FdEntry));
+	if (!pr->m_fds)
+		abort();
+
+	// Add control i/o watcher, level triggered
+	struct epoll_event ev = { .events = POLL_EVENT_RD, .data.fd = pr->m_control_recv_fd };
+	if (epoll_ctl(pr->m_epoll_fd,EPOLL_CTL_ADD,pr->m_control_recv_fd,&ev) != 0)
+		abort();
+
+	// Without a timerfd, precise timers get millisecond waits
+	pr->m_timer_fd_deadline = 0;
+	pr->m_timer_fd = timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK | TFD_CLOEXEC);
+	if (pr->m_timer_fd != -1)
+	{
+		ev.data.fd = pr->m_timer_fd;
+		if (epoll_ctl(pr->m_epoll_fd,EPOLL_CTL_ADD,pr->m_timer_fd,&ev) != 0)
+			abort();
+	}
+
+#if defined(PROACTOR_URING)
+	// Without io_uring, operations are done by the proactor when the fd is ready
+	if (uringInit(&pr->m_uring,URING_ENTRIES) == 0 && !(pr->m_uring.m_features & IORING_FEAT_FAST_POLL))
+		uringDestroy(&pr->m_uring);
+
+	if (pr->m_uring.m_fd != -1)
+	{
+		// The ring fd is readable while there are completions
+		ev.data.fd = pr->m_uring.m_fd;
+		if (epoll_ctl(pr->m_epoll_fd,EPOLL_CTL_ADD,pr->m_uring.m_fd,&ev) != 0)
+			abort();
+	}
+#endif
+#else
 	pr->m_poll_alloc_size = 4;
 	pr->m_n_poll_fds = 1;
 	pr->m_poll_fds = malloc(pr->m_poll_alloc_size * sizeof(struct pollfd));
 	if (!pr->m_poll_fds)
 		abort();
 
-	pr->m_watchers = malloc(pr->m_poll_alloc_size * 2 * sizeof(struct Watcher));
+	pr->m_watchers = malloc(pr->m_poll_alloc_size * 2 * sizeof(struct Watcher*));
 	if (!pr->m_watchers)
 		abort();
 
-	// Create socket_pair
-	socket_t control_fd = -1;
-	if (proactorSocketPair(&pr->m_control_fd,&control_fd) != 0)
-		abort();
-
 	// Add control i/o watcher
-	pr->m_poll_fds[0].fd = control_fd;
+	pr->m_poll_fds[0].fd = pr->m_control_recv_fd;
 	pr->m_poll_fds[0].events = POLL_EVENT_RD;
+#endif
+
+	return pr;
+}
+
+static void proactorFree(struct Proactor* pr)
+{
+#if !defined(_WIN32)
+	proactorStopFileThreads(pr);
+#endif
+	if (pr->m_control_fd != pr->m_control_recv_fd)
+		closesocket(pr->m_control_fd);
+	closesocket(pr->m_control_recv_fd);
+	ringDestroy(&pr->m_commands);
+#if defined(PROACTOR_EPOLL)
+#if defined(PROACTOR_URING)
+	uringDestroy(&pr->m_uring);
+#endif
+	if (pr->m_timer_fd != -1)
+		close(pr->m_timer_fd);
+	close(pr->m_epoll_fd);
+	free(pr->m_fds);
+#else
+	free(pr->m_watchers);
+	free(pr->m_poll_fds);
+#endif
+	for (size_t i = 0; i < pr->m_timer_count; ++i)
+	{
+		if (pr->m_timer_heap[i].m_timer->m_param_len > TIMER_SMALL_PARAM)
+			free(pr->m_timer_heap[i].m_timer->m_large_param);
+	}
+	free(pr->m_timer_heap);
+	free(pr->m_timer_hash);
+	while (pr->m_timer_chunks)
+	{
+		struct TimerChunk* next = pr->m_timer_chunks->m_next;
+		free(pr->m_timer_chunks);
+		pr->m_timer_chunks = next;
+	}
+	while (pr->m_watcher_chunks)
+	{
+		struct WatcherChunk* next = pr->m_watcher_chunks->m_next;
+		free(pr->m_watcher_chunks);
+		pr->m_watcher_chunks = next;
+	}
+	if (pr->m_dispatched)
+		proactorReleaseBatch(pr->m_dispatched,1);
+	free(pr->m_batch);
+	free(pr->m_inline);
+	free(pr->m_overflow);
+	while (pr->m_held)
+	{
+		// Never cancelled, so nothing is waiting on them
+		struct HeldCommand* next = pr->m_held->m_next;
+		if (pr->m_held->m_msg[0] == CMD_ADD_OP)
+		{
+			unsigned char* pp = pr->m_held->m_msg + 2;
+			struct Op* op;
+			READ_ARG(op,pp);
+			free(op);
+		}
+		free(pr->m_held);
+		pr->m_held = next;
+	}
+	if (atomic_load(&pr->m_stats_alloc))
+		statsRelease(atomic_load(&pr->m_stats_alloc));
+	free(pr);
+}
+
+proactor_t proactor_create(task_t parent)
+{
+	struct Proactor* pr = proactorCreate();
 
 	// Kick off a task to run it
 	pr->m_task = task_run(parent,&proactorRun,&pr,sizeof(pr));
@@ -815,16 +3602,211 @@ proactor_t proactor_create(task_t parent)
 	return (proactor_t)pr;
 }
 
+proactor_t proactor_create_idle(scheduler_t sc)
+{
+	struct Proactor* pr = proactorCreate();
+
+	// No task of its own, the scheduler's idle workers run it
+	pr->m_scheduler = sc;
+	if (scheduler_set_idle_poll(sc,&proactorIdlePoll,&proactorIdleWake,pr) != 0)
+	{
+		int err = errno;
+		proactorFree(pr);
+		errno = err;
+		return NULL;
+	}
+
+	return (proactor_t)pr;
+}
+
+void proactor_set_batch_dispatch(proactor_t ph, int enable)
+{
+	struct Proactor* pr = (struct Proactor*)ph;
+	if (pr)
+		atomic_store_explicit(&pr->m_batch_dispatch,enable != 0,memory_order_relaxed);
+}
+
+void proactor_set_watermarks(proactor_t ph, size_t high, size_t low)
+{
+	struct Proactor* pr = (struct Proactor*)ph;
+	if (pr)
+	{
+		atomic_store_explicit(&pr->m_low_water,low < high ? low : high,memory_order_relaxed);
+		atomic_store_explicit(&pr->m_high_water,high,memory_order_relaxed);
+	}
+}
+
+void proactor_get_load(proactor_t ph, struct proactor_load* load)
+{
+	struct Proactor* pr = (struct Proactor*)ph;
+	if (pr && load)
+	{
+		load->m_queue_depth = atomic_load_explicit(&pr->m_queue_depth,memory_order_relaxed);
+		load->m_overloads = atomic_load_explicit(&pr->m_overloads,memory_order_relaxed);
+		load->m_shed = atomic_load_explicit(&pr->m_shed,memory_order_relaxed);
+		load->m_deferred = atomic_load_explicit(&pr->m_deferred,memory_order_relaxed);
+	}
+}
+
+void proactor_set_busy_poll(proactor_t ph, uint32_t budget_us, unsigned int flags)
+{
+	struct Proactor* pr = (struct Proactor*)ph;
+	if (pr)
+	{
+		atomic_store_explicit(&pr->m_busy_poll_ns,(uint64_t)budget_us * 1000,memory_order_relaxed);
+		atomic_store_explicit(&pr->m_busy_poll_flags,flags,memory_order_relaxed);
+	}
+}
+
+static void statsInit(struct StatsHistogram* h)
+{
+	atomic_init(&h->m_sum,0);
+	atomic_init(&h->m_min,UINT64_MAX);
+	atomic_init(&h->m_max,0);
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+		atomic_init(&h->m_buckets[i],0);
+}
+
+void proactor_enable_stats(proactor_t ph, int enable)
+{
+	struct Proactor* pr = (struct Proactor*)ph;
+	if (!pr)
+		return;
+
+	struct ProactorStats* s = NULL;
+	if (enable)
+	{
+		s = atomic_load(&pr->m_stats_alloc);
+		if (!s)
+		{
+			struct ProactorStats* n = malloc(sizeof(struct ProactorStats));
+			if (!n)
+				abort();
+
+			atomic_init(&n->m_refs,1);
+			atomic_init(&n->m_timers,0);
+			atomic_init(&n->m_watchers,0);
+			statsInit(&n->m_loop_ns);
+			statsInit(&n->m_wait_ns);
+			statsInit(&n->m_ready_fds);
+			statsInit(&n->m_commands_per_read);
+			statsInit(&n->m_timer_late_ns);
+			statsInit(&n->m_dispatch_ns);
+
+			// Someone else may have got there first
+			if (atomic_compare_exchange_strong(&pr->m_stats_alloc,&s,n))
+				s = n;
+			else
+				free(n);
+		}
+	}
+	atomic_store_explicit(&pr->m_stats,s,memory_order_release);
+}
+
+static uint64_t statsTake(atomic_uint_fast64_t* v, uint64_t reset_to, int reset)
+{
+	return reset ? atomic_exchange_explicit(v,reset_to,memory_order_relaxed) : atomic_load_explicit(v,memory_order_relaxed);
+}
+
+// Returns the sum of the values
+// Recording carries on meanwhile, so the figures may be a value or two apart from one another
+static uint64_t statsSnapshot(struct StatsHistogram* h, struct proactor_histogram* out, int reset)
+{
+	uint64_t counts[HISTOGRAM_BUCKETS];
+	uint64_t count = 0;
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+		count += (counts[i] = statsTake(&h->m_buckets[i],0,reset));
+
+	uint64_t sum = statsTake(&h->m_sum,0,reset);
+	uint64_t min = statsTake(&h->m_min,UINT64_MAX,reset);
+	uint64_t max = statsTake(&h->m_max,0,reset);
+	if (!count)
+		return sum;
+
+	out->m_count = count;
+	out->m_min = min;
+	out->m_max = max;
+	out->m_mean = sum / count;
+
+	// Each percentile is the highest value of the bucket it falls in, within what was actually seen
+	const double ps[4] = { 0.5, 0.9, 0.99, 0.999 };
+	uint64_t* values[4] = { &out->m_p50, &out->m_p90, &out->m_p99, &out->m_p999 };
+	uint64_t seen = 0;
+	size_t i = 0;
+	for (size_t p = 0; p < 4; ++p)
+	{
+		double r = ps[p] * count;
+		uint64_t rank = (uint64_t)r;
+		if (rank < r || rank < 1)
+			++rank;
+		while (i < HISTOGRAM_BUCKETS - 1 && seen + counts[i] < rank)
+			seen += counts[i++];
+
+		uint64_t v = histogramValue(i);
+		*values[p] = v > max ? max : (v < min ? min : v);
+	}
+	return sum;
+}
+
+void proactor_get_stats(proactor_t ph, struct proactor_stats* stats, int reset)
+{
+	struct Proactor* pr = (struct Proactor*)ph;
+	if (!pr || !stats)
+		return;
+
+	memset(stats,0,sizeof(*stats));
+	struct ProactorStats* s = atomic_load(&pr->m_stats_alloc);
+	if (!s)
+		return;
+
+	statsSnapshot(&s->m_loop_ns,&stats->m_loop_ns,reset);
+	statsSnapshot(&s->m_wait_ns,&stats->m_wait_ns,reset);
+	statsSnapshot(&s->m_ready_fds,&stats->m_ready_fds,reset);
+	stats->m_commands = statsSnapshot(&s->m_commands_per_read,&stats->m_commands_per_read,reset);
+	statsSnapshot(&s->m_timer_late_ns,&stats->m_timer_late_ns,reset);
+	statsSnapshot(&s->m_dispatch_ns,&stats->m_dispatch_ns,reset);
+	stats->m_loops = stats->m_loop_ns.m_count;
+	stats->m_timers = atomic_load_explicit(&s->m_timers,memory_order_relaxed);
+	stats->m_watchers = atomic_load_explicit(&s->m_watchers,memory_order_relaxed);
+}
+
 void proactor_destroy(proactor_t pt)
 {
 	struct Proactor* pr = (struct Proactor*)pt;
 	if (pr)
 	{
-		// Close the control socket
-		closesocket(pr->m_control_fd);
-		task_join(pr->m_task);
-		free(pr->m_watchers);
-		free(pr->m_poll_fds);
-		free(pr);
+		if (pr->m_scheduler)
+		{
+			// Everything sent before this is handled first
+			_Alignas(16) unsigned char msg[2] = { CMD_EXIT, 2 };
+			// Once no worker is polling it, finish off the commands here, draining them inline if the ring is full
+			scheduler_set_idle_poll(pr->m_scheduler,NULL,NULL,NULL);
+			struct Proactor* prev_inline = s_inline_proactor;
+			s_inline_proactor = pr;
+			proactorWriteControl(pr,msg);
+			s_inline_proactor = prev_inline;
+
+			// The last turn, as the loop task would take it, so held callbacks still run
+			proactorLoopOnce(pr,0);
+		}
+		else
+		{
+			proactor_stop(pt);
+			task_join(pr->m_task);
+		}
+
+		proactorFree(pr);
+	}
+}
+
+void proactor_stop(proactor_t pt)
+{
+	struct Proactor* pr = (struct Proactor*)pt;
+	if (pr && !pr->m_scheduler && !pr->m_stopping)
+	{
+		// Everything sent before this is handled first
+		_Alignas(16) unsigned char msg[2] = { CMD_EXIT, 2 };
+		pr->m_stopping = 1;
+		proactorWriteControl(pr,msg);
 	}
 }
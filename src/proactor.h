@@ -14,6 +14,10 @@
 
 #if defined(_WIN32)
 #include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <sys/uio.h>
 #endif
 
 #if defined(_WIN32)
@@ -28,19 +32,171 @@ typedef struct opaque_proactor_t
 }* proactor_t;
 
 proactor_t proactor_create(task_t parent);
+
+// No task of its own: the scheduler's idle workers poll for events instead of sleeping, see scheduler_set_idle_poll()
+// Only one proactor per scheduler can be run this way
+proactor_t proactor_create_idle(scheduler_t sc);
 void proactor_destroy(proactor_t pr);
 
-unsigned int proactor_add_timer(proactor_t ph, uint32_t timeout, uint32_t repeat, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+// Tells a proactor's own loop task to finish, without waiting for it as proactor_destroy() does
+// A worker waiting on one loop may run another one meanwhile, so stop them all before destroying any of them
+void proactor_stop(proactor_t pr);
+
+// Instrumentation of the loop, off by default, when it costs a test of a pointer per turn
+// Times are in nanoseconds, and histogram values are to within 1/16th
+struct proactor_histogram
+{
+	uint64_t m_count;
+	uint64_t m_min;
+	uint64_t m_max;
+	uint64_t m_mean;
+	uint64_t m_p50;
+	uint64_t m_p90;
+	uint64_t m_p99;
+	uint64_t m_p999;
+};
+
+struct proactor_stats
+{
+	uint64_t m_loops;     // Turns of the loop
+	uint64_t m_commands;  // Commands from other threads
+	size_t   m_timers;    // Live timers, timed watchers' included, as of the last turn
+	size_t   m_watchers;  // Live watchers, as of the last turn
+	struct proactor_histogram m_loop_ns;            // Each turn, less any time asleep
+	struct proactor_histogram m_wait_ns;            // Each wait that could sleep
+	struct proactor_histogram m_ready_fds;          // Fds ready at each wakeup that found any
+	struct proactor_histogram m_commands_per_read;  // Commands taken each time the loop looked for any
+	struct proactor_histogram m_timer_late_ns;      // From a timer's deadline until it fired, slack included
+	struct proactor_histogram m_dispatch_ns;        // From an fd, timer or operation being ready until its callback started,
+	                                                // for callbacks whose param is no more than 64 bytes
+};
+
+void proactor_enable_stats(proactor_t ph, int enable);
+
+// Everything since stats were first enabled, or since the last reset, all zero if they never were
+void proactor_get_stats(proactor_t ph, struct proactor_stats* stats, int reset);
+
+// Watcher and timer callbacks ready at one wakeup are gathered up and handed to a single task, which splits them
+// across the workers, rather than a task_run() each from the proactor. Callbacks with no parent task are run
+// directly by the splitting tasks, a few to a task, so one that blocks holds up the others sharing its task
+void proactor_set_batch_dispatch(proactor_t ph, int enable);
+
+// Busy polling, trading a core for latency: after each wakeup the loop keeps polling without sleeping until
+// budget_us microseconds pass with nothing ready, so events are seen without a wakeup through the kernel, 0 turns it off
+// With proactor_create_idle() the polling worker runs what it hands out between polls, so it is the hot worker
+#define PROACTOR_BUSY_POLL_INLINE  1  // Watcher and timer callbacks with no parent run on the loop itself, and mustn't block
+#define PROACTOR_BUSY_POLL_SOCKETS 2  // SO_BUSY_POLL of budget_us on sockets watched from then on, may need CAP_NET_ADMIN
+void proactor_set_busy_poll(proactor_t ph, uint32_t budget_us, unsigned int flags);
+
+// Admission control: once more than high tasks are waiting for a worker, new recv watchers and recv or accept operations
+// are held back rather than armed until the queue drains to low, leaving the backlog in the kernel's socket buffers
+// Watchers that are already armed carry on, persistent ones included. 0 turns it off, which is the default
+void proactor_set_watermarks(proactor_t ph, size_t high, size_t low);
+
+// Whatever the watermarks, the loop never runs tasks itself when its task pool is full, callbacks wait in an overflow list
+struct proactor_load
+{
+	size_t   m_queue_depth;  // Tasks waiting for a worker or in the overflow list, last time admission control looked
+	uint64_t m_overloads;    // Times the high-water mark has been crossed
+	uint64_t m_shed;         // Recv watchers and operations held back over the high-water mark
+	uint64_t m_deferred;     // Callbacks that found the task pool full and waited in the overflow list
+};
+
+void proactor_get_load(proactor_t ph, struct proactor_load* load);
+
+// slack is how many milliseconds late the timer may fire, so timers can share a wakeup, 0 for none
+// The wait is in whole milliseconds, rounded up, so a timer may fire up to 1ms late even without slack
+unsigned int proactor_add_timer(proactor_t ph, uint32_t timeout, uint32_t repeat, uint32_t slack, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
 void proactor_cancel_timer(proactor_t ph, unsigned int timer_id);
 void proactor_update_timer(proactor_t ph, unsigned int timer_id, uint32_t timeout, uint32_t repeat);
 
+// Nanosecond timers, for pacing and retransmits, those with less than 1ms of slack get a precise sleep
+unsigned int proactor_add_timer_ns(proactor_t ph, uint64_t timeout_ns, uint64_t repeat_ns, uint64_t slack_ns, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+void proactor_update_timer_ns(proactor_t ph, unsigned int timer_id, uint64_t timeout_ns, uint64_t repeat_ns);
+
 void proactor_add_recv_watcher(proactor_t ph, socket_t fd, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
 void proactor_add_send_watcher(proactor_t ph, socket_t fd, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
 
-void proactor_add_timed_recv_watcher(proactor_t ph, socket_t fd, uint32_t timeout, task_t pt, task_fn_t io_fn, task_fn_t tmo_fn, const void* param, unsigned int param_len);
-void proactor_add_timed_send_watcher(proactor_t ph, socket_t fd, uint32_t timeout, task_t pt, task_fn_t io_fn, task_fn_t tmo_fn, const void* param, unsigned int param_len);
+// Persistent watchers stay armed until cancelled, running fn each time the fd is ready, with no re-arming per event
+// Level-triggered, fn runs again on every wakeup while the fd is still ready, even if an earlier run hasn't finished
+// Edge-triggered, fn runs only when more data or space arrives, so it must read or write until EAGAIN
+void proactor_add_persistent_recv_watcher(proactor_t ph, socket_t fd, int edge_triggered, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+void proactor_add_persistent_send_watcher(proactor_t ph, socket_t fd, int edge_triggered, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+
+void proactor_add_timed_recv_watcher(proactor_t ph, socket_t fd, uint32_t timeout, uint32_t slack, task_t pt, task_fn_t io_fn, task_fn_t tmo_fn, const void* param, unsigned int param_len);
+void proactor_add_timed_send_watcher(proactor_t ph, socket_t fd, uint32_t timeout, uint32_t slack, task_t pt, task_fn_t io_fn, task_fn_t tmo_fn, const void* param, unsigned int param_len);
 
 void proactor_cancel_recv_watcher(proactor_t ph, socket_t fd);
 void proactor_cancel_send_watcher(proactor_t ph, socket_t fd);
 
+// Completion based i/o, on io_uring where the kernel allows it
+// When the operation completes fn is run with a struct proactor_completion, followed by a copy of param
+// Operations on the same socket and direction complete in the order they were issued
+// The socket should be non-blocking, and the buffer must stay valid until the completion has run
+// proactor_cancel_recv_watcher()/proactor_cancel_send_watcher() complete outstanding operations with ECANCELED
+struct proactor_completion
+{
+	int      m_result;  // 0 or an errno value
+	union
+	{
+		socket_t     m_socket;     // The new socket, from proactor_accept()
+		unsigned int m_buffer_id;  // The buffer received into, from proactor_recv_buffer()
+	};
+	size_t   m_bytes;   // Bytes transferred
+};
+
+#define PROACTOR_PARAM_MAX (TASK_PARAM_MAX - sizeof(struct proactor_completion))
+#define PROACTOR_COMPLETION_PARAM(p) ((void*)((struct proactor_completion*)(p) + 1))
+
+int proactor_recv(proactor_t ph, socket_t fd, void* buf, size_t len, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+int proactor_send(proactor_t ph, socket_t fd, const void* buf, size_t len, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+
+#if !defined(_WIN32)
+// Completes once all of the iovecs are sent, with m_bytes sent so far if it fails
+// Sendv operations queued on a socket together go in one sendmsg(), the iovec array is copied but not what it points to
+int proactor_sendv(proactor_t ph, socket_t fd, const struct iovec* iov, int iovcnt, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+#endif
+
+#if defined(__linux__)
+// Datagram batches: the completion's m_bytes is the number of messages, each msg_len is filled in as recvmmsg()/sendmmsg() do
+// A receive takes however many datagrams are waiting, up to vlen, and a send completes once all vlen have gone
+// The mmsghdr array and everything it points to must stay valid until the completion has run
+struct mmsghdr;
+int proactor_recv_datagrams(proactor_t ph, socket_t fd, struct mmsghdr* msgs, unsigned int vlen, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+int proactor_send_datagrams(proactor_t ph, socket_t fd, struct mmsghdr* msgs, unsigned int vlen, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+
+// Sends len bytes of file_fd from offset, without them passing through user space, as fast as the socket takes them
+// Completes once, with m_bytes short of len if the file ends first, the file must stay open until then
+int proactor_sendfile(proactor_t ph, socket_t fd, int file_fd, uint64_t offset, size_t len, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+#endif
+
+#if !defined(_WIN32)
+// Regular files can't be polled, so these go to io_uring, or else to a few threads of the proactor's own
+// m_bytes is what pread()/pwrite() would have returned, and may be short
+int proactor_read_file(proactor_t ph, int fd, void* buf, size_t len, uint64_t offset, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+int proactor_write_file(proactor_t ph, int fd, const void* buf, size_t len, uint64_t offset, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+int proactor_fsync_file(proactor_t ph, int fd, int datasync, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+#endif
+
+int proactor_accept(proactor_t ph, socket_t fd, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+int proactor_connect(proactor_t ph, socket_t fd, const struct sockaddr* addr, socklen_t addr_len, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+
+// A pool of count buffers of size bytes each, carved from base, which must stay valid until the pool is destroyed
+// A pooled recv only takes a buffer once data arrives, so idle sockets hold no receive memory
+typedef struct opaque_proactor_buffers_t
+{
+	int _unused;
+}* proactor_buffers_t;
+
+proactor_buffers_t proactor_create_buffers(proactor_t ph, void* base, size_t size, unsigned int count);
+
+// Outstanding proactor_recv_buffer() calls on the pool must have completed first
+void proactor_destroy_buffers(proactor_buffers_t buffers);
+
+// If m_bytes is non-zero the completion owns buffer m_buffer_id, until it is handed back with proactor_return_buffer()
+// Fails with ENOBUFS if every buffer is owned, and m_bytes is 0 at end of stream
+int proactor_recv_buffer(proactor_t ph, socket_t fd, proactor_buffers_t buffers, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+void* proactor_buffer(proactor_buffers_t buffers, unsigned int buffer_id);
+void proactor_return_buffer(proactor_buffers_t buffers, unsigned int buffer_id);
+
 #endif /* SRC_PROACTOR_H_ */
@@ -0,0 +1,171 @@
+
+// For SO_REUSEPORT
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include "proactor_group.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#if defined(_WIN32)
+#define close_socket(s) closesocket(s)
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#define close_socket(s) close(s)
+#endif
+
+struct ProactorGroup
+{
+	unsigned int m_count;
+	proactor_t   m_shards[];
+};
+
+proactor_group_t proactor_group_create(task_t parent, unsigned int shards)
+{
+	// Each shard's loop holds a worker for good, and there must be one left over to run the completions
+	if (!shards || shards >= task_worker_count())
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	struct ProactorGroup* pg = malloc(sizeof(struct ProactorGroup) + shards * sizeof(proactor_t));
+	if (!pg)
+		abort();
+
+	pg->m_count = shards;
+	for (unsigned int i = 0; i < shards; ++i)
+		pg->m_shards[i] = proactor_create(parent);
+
+	return (proactor_group_t)pg;
+}
+
+void proactor_group_destroy(proactor_group_t ph)
+{
+	struct ProactorGroup* pg = (struct ProactorGroup*)ph;
+	if (pg)
+	{
+		for (unsigned int i = 0; i < pg->m_count; ++i)
+			proactor_stop(pg->m_shards[i]);
+
+		for (unsigned int i = 0; i < pg->m_count; ++i)
+			proactor_destroy(pg->m_shards[i]);
+
+		free(pg);
+	}
+}
+
+unsigned int proactor_group_size(proactor_group_t ph)
+{
+	return ((struct ProactorGroup*)ph)->m_count;
+}
+
+proactor_t proactor_group_get(proactor_group_t ph, unsigned int shard)
+{
+	struct ProactorGroup* pg = (struct ProactorGroup*)ph;
+	return pg->m_shards[shard % pg->m_count];
+}
+
+proactor_t proactor_group_for_fd(proactor_group_t ph, socket_t fd)
+{
+	struct ProactorGroup* pg = (struct ProactorGroup*)ph;
+
+	// fds are handed out densely, so mix the bits rather than striping
+	uint32_t h = (uint32_t)fd * UINT32_C(2654435761);
+	return pg->m_shards[(h >> 16) % pg->m_count];
+}
+
+static socket_t proactorGroupListener(const struct sockaddr* addr, socklen_t addr_len, int backlog, int reuse_port)
+{
+	socket_t s = socket(addr->sa_family,SOCK_STREAM,0);
+#if defined(_WIN32)
+	if (s == INVALID_SOCKET)
+		return -1;
+#else
+	if (s == -1)
+		return -1;
+
+	int flags = fcntl(s,F_GETFL,0);
+	if (flags == -1 || fcntl(s,F_SETFL,flags | O_NONBLOCK) == -1 || fcntl(s,F_SETFD,FD_CLOEXEC) == -1)
+	{
+		close_socket(s);
+		return -1;
+	}
+#endif
+
+	int on = 1;
+	if (setsockopt(s,SOL_SOCKET,SO_REUSEADDR,(const void*)&on,sizeof(on)) != 0)
+	{
+		close_socket(s);
+		return -1;
+	}
+
+#if defined(SO_REUSEPORT)
+	if (reuse_port && setsockopt(s,SOL_SOCKET,SO_REUSEPORT,(const void*)&on,sizeof(on)) != 0)
+	{
+		close_socket(s);
+		return -1;
+	}
+#endif
+
+	if (bind(s,addr,addr_len) != 0 || listen(s,backlog) != 0)
+	{
+		int err = errno;
+		close_socket(s);
+		errno = err;
+		return -1;
+	}
+	return s;
+}
+
+int proactor_group_listen(proactor_group_t ph, const struct sockaddr* addr, socklen_t addr_len, int backlog, socket_t* fds)
+{
+	struct ProactorGroup* pg = (struct ProactorGroup*)ph;
+	if (!pg || !addr || !fds)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+#if defined(SO_REUSEPORT)
+	unsigned int count = pg->m_count;
+#else
+	unsigned int count = 1;
+#endif
+
+	struct sockaddr_storage bound;
+	if (addr_len > sizeof(bound))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(&bound,addr,addr_len);
+
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		fds[i] = proactorGroupListener((const struct sockaddr*)&bound,addr_len,backlog,count > 1);
+
+		// If the caller asked for any port, the rest must share the one the first got
+		socklen_t len = addr_len;
+		if (i == 0 && fds[i] != -1 && getsockname(fds[i],(struct sockaddr*)&bound,&len) != 0)
+		{
+			close_socket(fds[i]);
+			fds[i] = -1;
+		}
+
+		if (fds[i] == -1)
+		{
+			int err = errno;
+			while (i-- > 0)
+				close_socket(fds[i]);
+
+			errno = err;
+			return -1;
+		}
+	}
+	return count;
+}
@@ -0,0 +1,30 @@
+
+#ifndef SRC_PROACTOR_GROUP_H_
+#define SRC_PROACTOR_GROUP_H_
+
+#include "proactor.h"
+
+typedef struct opaque_proactor_group_t
+{
+	int _unused;
+}* proactor_group_t;
+
+// A proactor per shard, each with its own event loop on its own worker
+// Completions are run as tasks from the shard's worker, so they start on that worker's deque
+// Every shard occupies a worker for good, so there must be fewer shards than the calling thread's scheduler has workers,
+// or this fails with EINVAL
+proactor_group_t proactor_group_create(task_t parent, unsigned int shards);
+void proactor_group_destroy(proactor_group_t pg);
+
+unsigned int proactor_group_size(proactor_group_t pg);
+proactor_t proactor_group_get(proactor_group_t pg, unsigned int shard);
+
+// The shard that owns fd, by hash. All watchers and operations on an fd must go to the same shard
+proactor_t proactor_group_for_fd(proactor_group_t pg, socket_t fd);
+
+// Opens a listening socket for every shard on the same address with SO_REUSEPORT, so the kernel spreads
+// incoming connections across them. fds[] must have room for proactor_group_size() sockets, fds[i] belongs to shard i
+// Returns the number of sockets opened, just the one if the platform can't share a port, or -1 with errno set
+int proactor_group_listen(proactor_group_t pg, const struct sockaddr* addr, socklen_t addr_len, int backlog, socket_t* fds);
+
+#endif /* SRC_PROACTOR_GROUP_H_ */
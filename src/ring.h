@@ -0,0 +1,141 @@
+
+#ifndef SRC_RING_H_
+#define SRC_RING_H_
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+// Bounded multi-producer, multi-consumer ring of fixed size elements
+// See http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue for details
+//
+// ringSend() and ringRecv() claim a run of ready cells with a single CAS, to amortize the cost over a batch
+
+struct Ring
+{
+	// Keep producers and consumers on separate cache lines
+	atomic_size_t  m_enqueue_pos;
+	char           m_pad0[64 - sizeof(atomic_size_t)];
+	atomic_size_t  m_dequeue_pos;
+	char           m_pad1[64 - sizeof(atomic_size_t)];
+
+	size_t         m_mask;
+	size_t         m_elem_size;
+	size_t         m_cell_size;
+	unsigned char* m_cells;
+};
+
+#define RING_CELL(r,pos) ((atomic_size_t*)((r)->m_cells + ((pos) & (r)->m_mask) * (r)->m_cell_size))
+
+static inline void ringInit(struct Ring* r, size_t capacity, size_t elem_size)
+{
+	size_t c = 2;
+	while (c < capacity)
+		c *= 2;
+
+	r->m_mask = c - 1;
+	r->m_elem_size = elem_size;
+	r->m_cell_size = (sizeof(atomic_size_t) + elem_size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+	r->m_cells = malloc(c * r->m_cell_size);
+	if (!r->m_cells)
+		abort();
+
+	for (size_t i = 0; i < c; ++i)
+		atomic_init(RING_CELL(r,i),i);
+
+	atomic_init(&r->m_enqueue_pos,0);
+	atomic_init(&r->m_dequeue_pos,0);
+}
+
+static inline void ringDestroy(struct Ring* r)
+{
+	free(r->m_cells);
+}
+
+static inline int ringEmpty(struct Ring* r)
+{
+	return atomic_load_explicit(&r->m_dequeue_pos,memory_order_relaxed) == atomic_load_explicit(&r->m_enqueue_pos,memory_order_relaxed);
+}
+
+static inline int ringFull(struct Ring* r)
+{
+	return atomic_load_explicit(&r->m_enqueue_pos,memory_order_relaxed) - atomic_load_explicit(&r->m_dequeue_pos,memory_order_relaxed) > r->m_mask;
+}
+
+// Returns the number of elements sent, which may be less than n if the ring is (nearly) full
+static inline size_t ringSend(struct Ring* r, const void* elems, size_t n)
+{
+	size_t pos = atomic_load_explicit(&r->m_enqueue_pos,memory_order_relaxed);
+	size_t count = 0;
+	while (n)
+	{
+		size_t seq = atomic_load_explicit(RING_CELL(r,pos),memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif < 0)
+			return 0; // Full
+
+		if (dif > 0)
+		{
+			pos = atomic_load_explicit(&r->m_enqueue_pos,memory_order_relaxed);
+			continue;
+		}
+
+		// Extend the run only over cells the consumers have finished with, so we never wait on them
+		count = 1;
+		while (count < n && atomic_load_explicit(RING_CELL(r,pos + count),memory_order_acquire) == pos + count)
+			++count;
+
+		if (atomic_compare_exchange_weak_explicit(&r->m_enqueue_pos,&pos,pos + count,memory_order_relaxed,memory_order_relaxed))
+			break;
+	}
+
+	const unsigned char* p = elems;
+	for (size_t i = 0; i < count; ++i, p += r->m_elem_size)
+	{
+		atomic_size_t* cell = RING_CELL(r,pos + i);
+		memcpy(cell + 1,p,r->m_elem_size);
+		atomic_store_explicit(cell,pos + i + 1,memory_order_release);
+	}
+	return count;
+}
+
+// Returns the number of elements received, which may be less than n if the ring is (nearly) empty
+static inline size_t ringRecv(struct Ring* r, void* elems, size_t n)
+{
+	size_t pos = atomic_load_explicit(&r->m_dequeue_pos,memory_order_relaxed);
+	size_t count = 0;
+	while (n)
+	{
+		size_t seq = atomic_load_explicit(RING_CELL(r,pos),memory_order_acquire);
+		intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (dif < 0)
+			return 0; // Empty
+
+		if (dif > 0)
+		{
+			pos = atomic_load_explicit(&r->m_dequeue_pos,memory_order_relaxed);
+			continue;
+		}
+
+		// Extend the run only over cells the producers have finished filling
+		count = 1;
+		while (count < n && atomic_load_explicit(RING_CELL(r,pos + count),memory_order_acquire) == pos + count + 1)
+			++count;
+
+		if (atomic_compare_exchange_weak_explicit(&r->m_dequeue_pos,&pos,pos + count,memory_order_relaxed,memory_order_relaxed))
+			break;
+	}
+
+	unsigned char* p = elems;
+	for (size_t i = 0; i < count; ++i, p += r->m_elem_size)
+	{
+		atomic_size_t* cell = RING_CELL(r,pos + i);
+		memcpy(p,cell + 1,r->m_elem_size);
+		atomic_store_explicit(cell,pos + i + r->m_mask + 1,memory_order_release);
+	}
+	return count;
+}
+
+#endif /* SRC_RING_H_ */
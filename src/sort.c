@@ -0,0 +1,651 @@
+
+#include "sort.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+// Work is cut into blocks of about the size of a per-core L2 cache
+#define BLOCK_BYTES (256 * 1024)
+
+// Runs this short are insertion sorted before merging
+#define INSERTION_RUN 16
+
+// Radix sort digits
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+
+typedef void (*for_fn_t)(void* ctx, size_t i);
+
+struct ForRange
+{
+	for_fn_t m_fn;
+	void*    m_ctx;
+	size_t   m_begin;
+	size_t   m_end;
+};
+
+static void forTask(task_t task, void* param)
+{
+	struct ForRange r = *(struct ForRange*)param;
+
+	// Split in half until one index remains, the halves are children of this task
+	while (r.m_end - r.m_begin > 1)
+	{
+		struct ForRange right = r;
+		right.m_begin = r.m_begin + (r.m_end - r.m_begin) / 2;
+		if (!task_run(task,&forTask,&right,sizeof(right)))
+			abort();
+
+		r.m_end = right.m_begin;
+	}
+
+	(*r.m_fn)(r.m_ctx,r.m_begin);
+}
+
+// Run fn(ctx,i) for i in [0,n) as descendants of pt, and wait for them all
+static int parallelFor(task_t pt, size_t n, for_fn_t fn, void* ctx)
+{
+	if (!n)
+		return 0;
+
+	struct ForRange r = { fn, ctx, 0, n };
+	task_t t = task_run(pt,&forTask,&r,sizeof(r));
+	if (!t)
+		return -1;
+
+	task_join(t);
+	return 0;
+}
+
+static size_t blockElems(size_t size)
+{
+	return size >= BLOCK_BYTES ? 1 : BLOCK_BYTES / size;
+}
+
+// Each merge pass takes up to this many runs at once, more streams than this thrash the cache and TLB
+#define MERGE_WAYS 32
+
+// Splitters are picked from about this many samples per output piece
+#define SAMPLE_RATE 16
+
+struct MergeSort
+{
+	unsigned char* m_base;
+	unsigned char* m_src;
+	unsigned char* m_dst;
+	size_t         m_count;
+	size_t         m_size;
+	size_t         m_width;
+	size_t         m_pieces;
+	unsigned char* m_samples;
+	size_t*        m_sample_counts;
+	size_t         m_group_samples;
+	size_t         m_record;
+	size_t         m_tag;
+	int (*m_compar)(const void*, const void*);
+};
+
+// Where a sample was taken from, stored after the copy of the element
+struct SampleTag
+{
+	size_t m_run;
+	size_t m_pos;
+};
+
+// Stable merge of the runs a and b into d, taking from a on ties
+static void mergeRuns(unsigned char* d, const unsigned char* a, size_t m, const unsigned char* b, size_t n, size_t size, int (*compar)(const void*, const void*))
+{
+	size_t i = 0, j = 0;
+	while (i < m && j < n)
+	{
+		if ((*compar)(a + i * size,b + j * size) <= 0)
+			memcpy(d,a + i++ * size,size);
+		else
+			memcpy(d,b + j++ * size,size);
+		d += size;
+	}
+
+	if (i < m)
+		memcpy(d,a + i * size,(m - i) * size);
+	else if (j < n)
+		memcpy(d,b + j * size,(n - j) * size);
+}
+
+// Unlike qsort() this is stable: insertion sort short runs, then merge them back and forth through tmp
+// Returns whichever of base or tmp the sorted elements ended up in
+static unsigned char* stableSort(unsigned char* base, unsigned char* tmp, size_t count, size_t size, int (*compar)(const void*, const void*))
+{
+	for (size_t lo = 0; lo < count; lo += INSERTION_RUN)
+	{
+		size_t hi = lo + INSERTION_RUN < count ? lo + INSERTION_RUN : count;
+		for (size_t i = lo + 1; i < hi; ++i)
+		{
+			size_t j = i;
+			while (j > lo && (*compar)(base + (j - 1) * size,base + i * size) > 0)
+				--j;
+
+			if (j != i)
+			{
+				memcpy(tmp,base + i * size,size);
+				memmove(base + (j + 1) * size,base + j * size,(i - j) * size);
+				memcpy(base + j * size,tmp,size);
+			}
+		}
+	}
+
+	unsigned char* src = base;
+	unsigned char* dst = tmp;
+	for (size_t width = INSERTION_RUN; width < count; width *= 2)
+	{
+		for (size_t lo = 0; lo < count; lo += 2 * width)
+		{
+			size_t mid = lo + width < count ? lo + width : count;
+			size_t hi = mid + width < count ? mid + width : count;
+			mergeRuns(dst + lo * size,src + lo * size,mid - lo,src + mid * size,hi - mid,size,compar);
+		}
+
+		unsigned char* t = src;
+		src = dst;
+		dst = t;
+	}
+
+	return src;
+}
+
+struct Copy
+{
+	unsigned char*       m_dst;
+	const unsigned char* m_src;
+	size_t               m_bytes;
+};
+
+static void copyBlock(void* ctx, size_t i)
+{
+	struct Copy* c = ctx;
+
+	size_t begin = i * BLOCK_BYTES;
+	size_t len = c->m_bytes - begin < BLOCK_BYTES ? c->m_bytes - begin : BLOCK_BYTES;
+	memcpy(c->m_dst + begin,c->m_src + begin,len);
+}
+
+static int parallelCopy(task_t pt, void* dst, const void* src, size_t bytes)
+{
+	struct Copy c = { dst, src, bytes };
+	return parallelFor(pt,(bytes + BLOCK_BYTES - 1) / BLOCK_BYTES,&copyBlock,&c);
+}
+
+static size_t mergeRunLength(const struct MergeSort* ms, size_t run)
+{
+	size_t begin = run * ms->m_width;
+	return ms->m_count - begin < ms->m_width ? ms->m_count - begin : ms->m_width;
+}
+
+// How many runs merge into group g of this pass
+static size_t mergeGroupRuns(const struct MergeSort* ms, size_t g)
+{
+	size_t runs = (ms->m_count + ms->m_width - 1) / ms->m_width;
+	return runs - g * MERGE_WAYS < MERGE_WAYS ? runs - g * MERGE_WAYS : MERGE_WAYS;
+}
+
+static void mergeSortBlock(void* ctx, size_t i)
+{
+	struct MergeSort* ms = ctx;
+
+	// Sorted into whichever buffer the first merge pass reads, the other one is free for scratch
+	size_t begin = i * ms->m_width * ms->m_size;
+	size_t len = mergeRunLength(ms,i);
+	unsigned char* run = ms->m_src + begin;
+	unsigned char* scratch = (ms->m_src == ms->m_base ? ms->m_dst : ms->m_src) + begin;
+	unsigned char* sorted = stableSort(ms->m_base + begin,scratch,len,ms->m_size,ms->m_compar);
+	if (sorted != run)
+		memcpy(run,sorted,len * ms->m_size);
+}
+
+// The number of elements of a run that come before x, either all those less than it or all those not greater
+static size_t mergeBound(const struct MergeSort* ms, size_t run, const void* x, int upper)
+{
+	const unsigned char* r = ms->m_src + run * ms->m_width * ms->m_size;
+	size_t lo = 0, hi = mergeRunLength(ms,run);
+	while (lo < hi)
+	{
+		size_t i = lo + (hi - lo) / 2;
+		int c = (*ms->m_compar)(r + i * ms->m_size,x);
+		if (c < 0 || (upper && c == 0))
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	return lo;
+}
+
+// Where the boundary before output piece p of group g falls in each of its runs
+static void mergeSplits(const struct MergeSort* ms, size_t g, size_t p, size_t* pos)
+{
+	size_t first = g * MERGE_WAYS;
+	size_t k = mergeGroupRuns(ms,g);
+	if (p == 0 || p == ms->m_pieces)
+	{
+		for (size_t j = 0; j < k; ++j)
+			pos[j] = p ? mergeRunLength(ms,first + j) : 0;
+		return;
+	}
+
+	// Ties with the splitter are ordered by run and then position, as a stable merge would take them
+	size_t sample = p * ms->m_sample_counts[g] / ms->m_pieces;
+	const unsigned char* x = ms->m_samples + (g * ms->m_group_samples + sample) * ms->m_record;
+	const struct SampleTag* tag = (const struct SampleTag*)(x + ms->m_tag);
+	for (size_t j = 0; j < k; ++j)
+	{
+		if (first + j == tag->m_run)
+			pos[j] = tag->m_pos;
+		else
+			pos[j] = mergeBound(ms,first + j,x,first + j < tag->m_run);
+	}
+}
+
+// Sort samples evenly spaced through each run of group g, tagged with where they came from
+static void mergeSampleGroup(void* ctx, size_t g)
+{
+	struct MergeSort* ms = ctx;
+
+	size_t k = mergeGroupRuns(ms,g);
+	size_t per_run = (ms->m_pieces * SAMPLE_RATE + k - 1) / k;
+	unsigned char* samples = ms->m_samples + g * ms->m_group_samples * ms->m_record;
+
+	// Taken in run order, so that a stable sort breaks ties by run and position
+	unsigned char* s = samples;
+	for (size_t j = g * MERGE_WAYS; j < g * MERGE_WAYS + k; ++j)
+	{
+		size_t len = mergeRunLength(ms,j);
+		size_t n = per_run < len ? per_run : len;
+		for (size_t i = 0; i < n; ++i)
+		{
+			struct SampleTag t = { j, (2 * i + 1) * len / (2 * n) };
+			memcpy(s,ms->m_src + (j * ms->m_width + t.m_pos) * ms->m_size,ms->m_size);
+			memcpy(s + ms->m_tag,&t,sizeof(t));
+			s += ms->m_record;
+		}
+	}
+
+	size_t count = (size_t)(s - samples) / ms->m_record;
+	unsigned char* sorted = stableSort(samples,s,count,ms->m_record,ms->m_compar);
+	if (sorted != samples)
+		memcpy(samples,sorted,count * ms->m_record);
+
+	ms->m_sample_counts[g] = count;
+}
+
+// Whether run a comes out of the merge before run b, an exhausted run has a NULL head and never does
+static inline int mergeBeats(const struct MergeSort* ms, const unsigned char* const* head, size_t a, size_t b)
+{
+	if (!head[b])
+		return 1;
+	if (!head[a])
+		return 0;
+
+	int c = (*ms->m_compar)(head[a],head[b]);
+	return c < 0 || (c == 0 && a < b);
+}
+
+static void mergePiece(void* ctx, size_t idx)
+{
+	struct MergeSort* ms = ctx;
+
+	size_t g = idx / ms->m_pieces;
+	size_t k = mergeGroupRuns(ms,g);
+
+	size_t lo[MERGE_WAYS], hi[MERGE_WAYS], tree[MERGE_WAYS];
+	const unsigned char* head[MERGE_WAYS];
+	const unsigned char* end[MERGE_WAYS];
+
+	mergeSplits(ms,g,idx % ms->m_pieces,lo);
+	mergeSplits(ms,g,idx % ms->m_pieces + 1,hi);
+
+	size_t out = g * MERGE_WAYS * ms->m_width, total = 0;
+	for (size_t j = 0; j < k; ++j)
+	{
+		const unsigned char* r = ms->m_src + (g * MERGE_WAYS + j) * ms->m_width * ms->m_size;
+		head[j] = hi[j] > lo[j] ? r + lo[j] * ms->m_size : NULL;
+		end[j] = r + hi[j] * ms->m_size;
+		out += lo[j];
+		total += hi[j] - lo[j];
+	}
+
+	// A loser tree: run j is leaf k + j, each inner node holds the loser of its subtree and tree[0] the winner
+	for (size_t n = 0; n < k; ++n)
+		tree[n] = k;
+
+	for (size_t j = 0; j < k; ++j)
+	{
+		size_t w = j;
+		size_t n = (j + k) / 2;
+		for (; n > 0; n /= 2)
+		{
+			// The first to arrive waits there for the winner of the other side
+			if (tree[n] == k)
+			{
+				tree[n] = w;
+				break;
+			}
+
+			if (mergeBeats(ms,head,tree[n],w))
+			{
+				size_t t = tree[n];
+				tree[n] = w;
+				w = t;
+			}
+		}
+		if (!n)
+			tree[0] = w;
+	}
+
+	unsigned char* d = ms->m_dst + out * ms->m_size;
+	for (size_t i = 0; i < total; ++i)
+	{
+		size_t w = tree[0];
+		memcpy(d,head[w],ms->m_size);
+		d += ms->m_size;
+		head[w] += ms->m_size;
+		if (head[w] == end[w])
+			head[w] = NULL;
+
+		for (size_t n = (w + k) / 2; n > 0; n /= 2)
+		{
+			if (mergeBeats(ms,head,tree[n],w))
+			{
+				size_t t = tree[n];
+				tree[n] = w;
+				w = t;
+			}
+		}
+		tree[0] = w;
+	}
+}
+
+int task_parallel_sort(task_t pt, void* base, size_t count, size_t size, int (*compar)(const void*, const void*))
+{
+	if ((!base && count) || !size || !compar)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!count)
+		return 0;
+
+	unsigned char* tmp = malloc(count * size);
+	if (!tmp)
+		abort();
+
+	struct MergeSort ms = { base, base, tmp, count, size, blockElems(size), 0, NULL, NULL, 0, 0, 0, compar };
+
+	// Each pass merges up to MERGE_WAYS runs into one, so pick the buffer for the sorted blocks that has the last pass land in base
+	size_t runs = (count + ms.m_width - 1) / ms.m_width;
+	size_t passes = 0;
+	for (size_t r = runs; r > 1; r = (r + MERGE_WAYS - 1) / MERGE_WAYS)
+		++passes;
+
+	if (passes % 2)
+	{
+		ms.m_src = tmp;
+		ms.m_dst = base;
+	}
+
+	// A sample record is a copy of the element, followed by its tag
+	ms.m_tag = (size + _Alignof(struct SampleTag) - 1) / _Alignof(struct SampleTag) * _Alignof(struct SampleTag);
+	ms.m_record = (ms.m_tag + sizeof(struct SampleTag) + _Alignof(max_align_t) - 1) / _Alignof(max_align_t) * _Alignof(max_align_t);
+
+	int err = parallelFor(pt,runs,&mergeSortBlock,&ms);
+	for (; passes && !err; --passes)
+	{
+		// A block's worth of output per piece, but enough pieces to keep every worker busy
+		size_t groups = (runs + MERGE_WAYS - 1) / MERGE_WAYS;
+		size_t group_len = ms.m_width * (runs < MERGE_WAYS ? runs : MERGE_WAYS);
+		size_t slack = (4 * (size_t)task_worker_count() + groups - 1) / groups;
+		ms.m_pieces = runs < MERGE_WAYS ? runs : MERGE_WAYS;
+		if (ms.m_pieces < slack)
+			ms.m_pieces = slack;
+		if (ms.m_pieces > group_len)
+			ms.m_pieces = group_len;
+
+		// Room for each group's samples, and as many again for sorting them
+		ms.m_group_samples = 2 * (ms.m_pieces * SAMPLE_RATE + MERGE_WAYS);
+		ms.m_samples = malloc(groups * (ms.m_group_samples * ms.m_record + sizeof(size_t)));
+		if (!ms.m_samples)
+			abort();
+
+		ms.m_sample_counts = (size_t*)(ms.m_samples + groups * ms.m_group_samples * ms.m_record);
+
+		if ((err = parallelFor(pt,groups,&mergeSampleGroup,&ms)) == 0)
+			err = parallelFor(pt,groups * ms.m_pieces,&mergePiece,&ms);
+
+		free(ms.m_samples);
+
+		unsigned char* t = ms.m_src;
+		ms.m_src = ms.m_dst;
+		ms.m_dst = t;
+		ms.m_width = groups > 1 ? ms.m_width * MERGE_WAYS : count;
+		runs = groups;
+	}
+
+	free(tmp);
+	return err;
+}
+
+struct RadixSort
+{
+	unsigned char* m_src;
+	unsigned char* m_dst;
+	size_t         m_count;
+	size_t         m_block;
+	unsigned int   m_key_size;
+	unsigned int   m_shift;
+	size_t*        m_offsets; // [block][digit]
+};
+
+static inline unsigned int radixDigit(const struct RadixSort* rs, size_t i)
+{
+	if (rs->m_key_size == sizeof(uint32_t))
+		return (((const uint32_t*)rs->m_src)[i] >> rs->m_shift) & (RADIX_SIZE - 1);
+
+	return (((const uint64_t*)rs->m_src)[i] >> rs->m_shift) & (RADIX_SIZE - 1);
+}
+
+static void radixHistogram(void* ctx, size_t b)
+{
+	struct RadixSort* rs = ctx;
+	size_t* h = &rs->m_offsets[b * RADIX_SIZE];
+
+	size_t begin = b * rs->m_block;
+	size_t end = begin + rs->m_block < rs->m_count ? begin + rs->m_block : rs->m_count;
+
+	memset(h,0,RADIX_SIZE * sizeof(size_t));
+	for (size_t i = begin; i < end; ++i)
+		++h[radixDigit(rs,i)];
+}
+
+static void radixScatter(void* ctx, size_t b)
+{
+	struct RadixSort* rs = ctx;
+	size_t* o = &rs->m_offsets[b * RADIX_SIZE];
+
+	size_t begin = b * rs->m_block;
+	size_t end = begin + rs->m_block < rs->m_count ? begin + rs->m_block : rs->m_count;
+
+	if (rs->m_key_size == sizeof(uint32_t))
+	{
+		for (size_t i = begin; i < end; ++i)
+			((uint32_t*)rs->m_dst)[o[radixDigit(rs,i)]++] = ((const uint32_t*)rs->m_src)[i];
+	}
+	else
+	{
+		for (size_t i = begin; i < end; ++i)
+			((uint64_t*)rs->m_dst)[o[radixDigit(rs,i)]++] = ((const uint64_t*)rs->m_src)[i];
+	}
+}
+
+static int radixSort(task_t pt, void* keys, size_t count, unsigned int key_size)
+{
+	if (!keys && count)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct RadixSort rs = { keys, NULL, count, blockElems(key_size), key_size, 0, NULL };
+	size_t blocks = (count + rs.m_block - 1) / rs.m_block;
+	if (!blocks)
+		return 0;
+
+	rs.m_offsets = malloc(blocks * RADIX_SIZE * sizeof(size_t));
+	rs.m_dst = malloc(count * key_size);
+	if (!rs.m_offsets || !rs.m_dst)
+		abort();
+
+	void* tmp = rs.m_dst;
+	int err = 0;
+	for (rs.m_shift = 0; rs.m_shift < key_size * 8 && !err; rs.m_shift += RADIX_BITS)
+	{
+		if ((err = parallelFor(pt,blocks,&radixHistogram,&rs)) != 0)
+			break;
+
+		// Turn the per-block counts into output offsets, digit major
+		size_t sum = 0;
+		int skip = 0;
+		for (unsigned int d = 0; d < RADIX_SIZE && !skip; ++d)
+		{
+			size_t total = 0;
+			for (size_t b = 0; b < blocks; ++b)
+			{
+				size_t c = rs.m_offsets[b * RADIX_SIZE + d];
+				rs.m_offsets[b * RADIX_SIZE + d] = sum;
+				sum += c;
+				total += c;
+			}
+
+			// Every key has the same digit, so this pass would change nothing
+			if (total == count)
+				skip = 1;
+		}
+
+		if (!skip)
+		{
+			if ((err = parallelFor(pt,blocks,&radixScatter,&rs)) != 0)
+				break;
+
+			unsigned char* t = rs.m_src;
+			rs.m_src = rs.m_dst;
+			rs.m_dst = t;
+		}
+	}
+
+	if (!err && rs.m_src != (unsigned char*)keys)
+		err = parallelCopy(pt,keys,rs.m_src,count * key_size);
+
+	free(tmp);
+	free(rs.m_offsets);
+	return err;
+}
+
+int task_parallel_sort_u32(task_t pt, uint32_t* keys, size_t count)
+{
+	return radixSort(pt,keys,count,sizeof(uint32_t));
+}
+
+int task_parallel_sort_u64(task_t pt, uint64_t* keys, size_t count)
+{
+	return radixSort(pt,keys,count,sizeof(uint64_t));
+}
+
+struct Partition
+{
+	unsigned char* m_base;
+	unsigned char* m_tmp;
+	unsigned char* m_flags;
+	size_t         m_count;
+	size_t         m_size;
+	size_t         m_block;
+	size_t         m_true_count;
+	size_t*        m_offsets; // [block][false,true]
+	int (*m_pred)(const void*, void*);
+	void*          m_ctx;
+};
+
+static void partitionCount(void* ctx, size_t b)
+{
+	struct Partition* p = ctx;
+
+	size_t begin = b * p->m_block;
+	size_t end = begin + p->m_block < p->m_count ? begin + p->m_block : p->m_count;
+
+	// Remember each answer, so pred() is only called once per element
+	size_t t = 0;
+	for (size_t i = begin; i < end; ++i)
+		t += (p->m_flags[i] = ((*p->m_pred)(p->m_base + i * p->m_size,p->m_ctx) != 0));
+
+	p->m_offsets[b * 2] = (end - begin) - t;
+	p->m_offsets[b * 2 + 1] = t;
+}
+
+static void partitionScatter(void* ctx, size_t b)
+{
+	struct Partition* p = ctx;
+
+	size_t begin = b * p->m_block;
+	size_t end = begin + p->m_block < p->m_count ? begin + p->m_block : p->m_count;
+
+	size_t o[2] = { p->m_offsets[b * 2], p->m_offsets[b * 2 + 1] };
+	for (size_t i = begin; i < end; ++i)
+		memcpy(p->m_tmp + o[p->m_flags[i]]++ * p->m_size,p->m_base + i * p->m_size,p->m_size);
+}
+
+size_t task_parallel_partition(task_t pt, void* base, size_t count, size_t size, int (*pred)(const void* elem, void* ctx), void* ctx)
+{
+	if ((!base && count) || !size || !pred)
+	{
+		errno = EINVAL;
+		return (size_t)-1;
+	}
+
+	struct Partition p = { base, NULL, NULL, count, size, blockElems(size), 0, NULL, pred, ctx };
+	size_t blocks = (count + p.m_block - 1) / p.m_block;
+	if (!blocks)
+		return 0;
+
+	p.m_tmp = malloc(count * size);
+	p.m_flags = malloc(count);
+	p.m_offsets = malloc(blocks * 2 * sizeof(size_t));
+	if (!p.m_tmp || !p.m_flags || !p.m_offsets)
+		abort();
+
+	size_t ret = (size_t)-1;
+	if (parallelFor(pt,blocks,&partitionCount,&p) == 0)
+	{
+		// Trues go first, in block order, then the falses
+		for (size_t b = 0; b < blocks; ++b)
+			p.m_true_count += p.m_offsets[b * 2 + 1];
+
+		size_t t = 0, f = p.m_true_count;
+		for (size_t b = 0; b < blocks; ++b)
+		{
+			size_t c = p.m_offsets[b * 2];
+			p.m_offsets[b * 2] = f;
+			f += c;
+
+			c = p.m_offsets[b * 2 + 1];
+			p.m_offsets[b * 2 + 1] = t;
+			t += c;
+		}
+
+		if (parallelFor(pt,blocks,&partitionScatter,&p) == 0 && parallelCopy(pt,base,p.m_tmp,count * size) == 0)
+			ret = p.m_true_count;
+	}
+
+	free(p.m_offsets);
+	free(p.m_flags);
+	free(p.m_tmp);
+	return ret;
+}
@@ -0,0 +1,21 @@
+
+#ifndef SRC_SORT_H_
+#define SRC_SORT_H_
+
+#include "task.h"
+
+#include <stdint.h>
+
+// All of these run as children of pt, and return once the work is complete
+
+// A stable sort with the same contract as qsort(): cache sized blocks are sorted, then multiway merged, split between tasks at sampled splitters
+int task_parallel_sort(task_t pt, void* base, size_t count, size_t size, int (*compar)(const void*, const void*));
+
+// LSD radix sorts for plain integer keys
+int task_parallel_sort_u32(task_t pt, uint32_t* keys, size_t count);
+int task_parallel_sort_u64(task_t pt, uint64_t* keys, size_t count);
+
+// Stable partition: moves the elements for which pred() is non-zero to the front, and returns how many there are
+size_t task_parallel_partition(task_t pt, void* base, size_t count, size_t size, int (*pred)(const void* elem, void* ctx), void* ctx);
+
+#endif /* SRC_SORT_H_ */
@@ -0,0 +1,151 @@
+
+#include "strand.h"
+#include "mpsc.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+// The most items a single drain task will run before yielding its worker
+#define STRAND_BATCH 32
+
+struct StrandItem
+{
+	struct MpscNode m_node;
+	task_fn_t       m_fn;
+
+	_Alignas(max_align_t) char m_data[];
+};
+
+struct Strand
+{
+	struct MpscQueue m_queue;
+	task_t           m_parent;
+
+	// Count of posted items not yet run, the drain task is live while this is non-zero
+	atomic_size_t    m_pending;
+};
+
+struct StrandBinding
+{
+	struct Strand* m_strand;
+	task_fn_t      m_fn;
+	unsigned int   m_param_len;
+
+	_Alignas(max_align_t) char m_param[STRAND_PARAM_MAX];
+};
+
+static_assert(sizeof(struct StrandBinding) <= TASK_PARAM_MAX,"STRAND_PARAM_MAX is too large");
+
+static void strandDrain(task_t task, void* param);
+
+static void strandSchedule(struct Strand* st)
+{
+	if (!task_run(st->m_parent,&strandDrain,&st,sizeof(st)))
+		abort();
+}
+
+static void strandDrain(task_t task, void* param)
+{
+	struct Strand* st = *(struct Strand**)param;
+
+	for (unsigned int i = 0; i < STRAND_BATCH; ++i)
+	{
+		struct StrandItem* item = (struct StrandItem*)mpscPop(&st->m_queue);
+		if (!item)
+		{
+			// A producer has counted its item, but not linked it in yet
+			break;
+		}
+
+		(*item->m_fn)(task,item->m_data);
+		free(item);
+
+		if (atomic_fetch_sub_explicit(&st->m_pending,1,memory_order_acq_rel) == 1)
+			return;
+	}
+
+	// Give the worker back, but stay scheduled
+	strandSchedule(st);
+}
+
+int strand_post(strand_t sh, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	struct Strand* st = (struct Strand*)sh;
+	if (!st || !fn || param_len > TASK_PARAM_MAX)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	struct StrandItem* item = malloc(sizeof(struct StrandItem) + param_len);
+	if (!item)
+		abort();
+
+	item->m_fn = fn;
+	memcpy(item->m_data,param,param_len);
+
+	mpscPush(&st->m_queue,&item->m_node);
+
+	// Only the post that takes m_pending off zero starts a drain
+	if (atomic_fetch_add_explicit(&st->m_pending,1,memory_order_acq_rel) == 0)
+		strandSchedule(st);
+
+	return 0;
+}
+
+unsigned int strand_bind(strand_t sh, task_fn_t fn, const void* param, unsigned int param_len, void* binding)
+{
+	if (!sh || !fn || param_len > STRAND_PARAM_MAX)
+	{
+		errno = EINVAL;
+		return 0;
+	}
+
+	struct StrandBinding b;
+	b.m_strand = (struct Strand*)sh;
+	b.m_fn = fn;
+	b.m_param_len = param_len;
+	memcpy(b.m_param,param,param_len);
+
+	// binding may not be aligned
+	unsigned int len = offsetof(struct StrandBinding,m_param) + param_len;
+	memcpy(binding,&b,len);
+	return len;
+}
+
+void strand_dispatch(task_t task, void* binding)
+{
+	struct StrandBinding* b = binding;
+
+	if (strand_post((strand_t)b->m_strand,b->m_fn,b->m_param,b->m_param_len) != 0)
+		abort();
+}
+
+strand_t strand_create(task_t parent)
+{
+	struct Strand* st = malloc(sizeof(struct Strand));
+	if (!st)
+		abort();
+
+	mpscInit(&st->m_queue);
+	st->m_parent = parent;
+	atomic_init(&st->m_pending,0);
+
+	return (strand_t)st;
+}
+
+void strand_destroy(strand_t sh)
+{
+	struct Strand* st = (struct Strand*)sh;
+	if (st)
+	{
+		// Help out until everything posted has run
+		while (atomic_load_explicit(&st->m_pending,memory_order_acquire) != 0)
+			task_work();
+
+		free(st);
+	}
+}
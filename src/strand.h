@@ -0,0 +1,26 @@
+
+#ifndef SRC_STRAND_H_
+#define SRC_STRAND_H_
+
+#include "task.h"
+
+typedef struct opaque_strand_t
+{
+	int _unused;
+}* strand_t;
+
+// Tasks posted to a strand run in order, and never concurrently
+strand_t strand_create(task_t parent);
+void strand_destroy(strand_t st);
+
+int strand_post(strand_t st, task_fn_t fn, const void* param, unsigned int param_len);
+
+// Binds fn and param to a strand, for use as a task_fn_t elsewhere, e.g.
+//   len = strand_bind(st,fn,param,param_len,buf);
+//   proactor_add_recv_watcher(pr,fd,pt,&strand_dispatch,buf,len);
+#define STRAND_PARAM_MAX (TASK_PARAM_MAX - 32)
+
+unsigned int strand_bind(strand_t st, task_fn_t fn, const void* param, unsigned int param_len, void* binding);
+void strand_dispatch(task_t task, void* binding);
+
+#endif /* SRC_STRAND_H_ */
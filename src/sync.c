@@ -0,0 +1,375 @@
+
+#include "sync.h"
+#include "mpsc.h"
+#include "threads.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+struct Waiter
+{
+	struct MpscNode m_node;
+	task_t          m_parent;
+	task_fn_t       m_fn;
+	unsigned int    m_param_len;
+
+	_Alignas(max_align_t) char m_param[];
+};
+
+struct Semaphore
+{
+	// Positive for available units, negative for parked waiters
+	atomic_long      m_count;
+	atomic_flag      m_pop_lock;
+	struct MpscQueue m_waiters;
+};
+
+struct Event
+{
+	// A LIFO of parked waiters, or EVENT_SIGNALLED
+	_Atomic(struct Waiter*) m_waiters;
+};
+
+#define EVENT_SIGNALLED ((struct Waiter*)1)
+
+struct Latch
+{
+	atomic_uint  m_count;
+	struct Event m_event;
+};
+
+// The caller must have already retained pt, to keep it open while we are parked
+static struct Waiter* waiterCreate(task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	struct Waiter* w = malloc(sizeof(struct Waiter) + param_len);
+	if (!w)
+		abort();
+
+	w->m_parent = pt;
+	w->m_fn = fn;
+	w->m_param_len = param_len;
+	memcpy(w->m_param,param,param_len);
+	return w;
+}
+
+static void waiterRun(struct Waiter* w)
+{
+	// Runs on the releasing thread's deque
+	if (!task_run(w->m_parent,w->m_fn,w->m_param,w->m_param_len))
+		abort();
+
+	task_release(w->m_parent);
+	free(w);
+}
+
+static void waiterDiscard(struct Waiter* w)
+{
+	task_release(w->m_parent);
+	free(w);
+}
+
+static int waiterRetain(task_t pt, task_fn_t fn, unsigned int param_len)
+{
+	if (!fn || param_len > TASK_PARAM_MAX)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+	return task_retain(pt);
+}
+
+static void runNow(task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (!task_run(pt,fn,param,param_len))
+		abort();
+
+	task_release(pt);
+}
+
+static struct Waiter* semaphorePop(struct Semaphore* s)
+{
+	// The waiter is allocated before it is counted, so at worst its push is a couple of stores from finishing
+	struct MpscNode* n;
+	while (!(n = mpscPop(&s->m_waiters)))
+		thrd_yield();
+
+	return (struct Waiter*)n;
+}
+
+static void semaphoreInit(struct Semaphore* s, long count)
+{
+	atomic_init(&s->m_count,count);
+	atomic_flag_clear(&s->m_pop_lock);
+	mpscInit(&s->m_waiters);
+}
+
+static int semaphoreTryWait(struct Semaphore* s)
+{
+	long c = atomic_load_explicit(&s->m_count,memory_order_relaxed);
+	while (c > 0)
+	{
+		if (atomic_compare_exchange_weak_explicit(&s->m_count,&c,c-1,memory_order_acquire,memory_order_relaxed))
+			return 1;
+	}
+	return 0;
+}
+
+static int semaphoreWait(struct Semaphore* s, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (waiterRetain(pt,fn,param_len) != 0)
+		return -1;
+
+	if (semaphoreTryWait(s))
+	{
+		runNow(pt,fn,param,param_len);
+		return 0;
+	}
+
+	// Probably contended, so have the continuation ready before we are counted
+	struct Waiter* w = waiterCreate(pt,fn,param,param_len);
+	if (atomic_fetch_sub_explicit(&s->m_count,1,memory_order_acquire) > 0)
+		waiterRun(w);
+	else
+		mpscPush(&s->m_waiters,&w->m_node);
+
+	return 0;
+}
+
+static void semaphorePost(struct Semaphore* s, int single_poster)
+{
+	if (atomic_fetch_add_explicit(&s->m_count,1,memory_order_release) >= 0)
+		return;
+
+	// Hand the unit straight to a waiter
+	struct Waiter* w;
+	if (single_poster)
+		w = semaphorePop(s);
+	else
+	{
+		while (atomic_flag_test_and_set_explicit(&s->m_pop_lock,memory_order_acquire))
+			;
+
+		w = semaphorePop(s);
+
+		atomic_flag_clear_explicit(&s->m_pop_lock,memory_order_release);
+	}
+
+	waiterRun(w);
+}
+
+static void semaphoreDestroy(struct Semaphore* s)
+{
+	struct MpscNode* n;
+	while ((n = mpscPop(&s->m_waiters)))
+		waiterDiscard((struct Waiter*)n);
+
+	free(s);
+}
+
+task_mutex_t task_mutex_create(void)
+{
+	struct Semaphore* s = malloc(sizeof(struct Semaphore));
+	if (!s)
+		abort();
+
+	semaphoreInit(s,1);
+	return (task_mutex_t)s;
+}
+
+void task_mutex_destroy(task_mutex_t m)
+{
+	if (m)
+	{
+		assert(atomic_load(&((struct Semaphore*)m)->m_count) == 1);
+		semaphoreDestroy((struct Semaphore*)m);
+	}
+}
+
+int task_mutex_trylock(task_mutex_t m)
+{
+	return semaphoreTryWait((struct Semaphore*)m);
+}
+
+int task_mutex_lock(task_mutex_t m, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	return semaphoreWait((struct Semaphore*)m,pt,fn,param,param_len);
+}
+
+void task_mutex_unlock(task_mutex_t m)
+{
+	// Only the owner unlocks, so there is only ever one consumer of the waiters
+	semaphorePost((struct Semaphore*)m,1);
+}
+
+task_sem_t task_sem_create(unsigned int count)
+{
+	struct Semaphore* s = malloc(sizeof(struct Semaphore));
+	if (!s)
+		abort();
+
+	semaphoreInit(s,count);
+	return (task_sem_t)s;
+}
+
+void task_sem_destroy(task_sem_t s)
+{
+	if (s)
+		semaphoreDestroy((struct Semaphore*)s);
+}
+
+int task_sem_trywait(task_sem_t s)
+{
+	return semaphoreTryWait((struct Semaphore*)s);
+}
+
+int task_sem_wait(task_sem_t s, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	return semaphoreWait((struct Semaphore*)s,pt,fn,param,param_len);
+}
+
+void task_sem_post(task_sem_t s)
+{
+	semaphorePost((struct Semaphore*)s,0);
+}
+
+static void eventInit(struct Event* ev, int signalled)
+{
+	atomic_init(&ev->m_waiters,signalled ? EVENT_SIGNALLED : NULL);
+}
+
+static int eventWait(struct Event* ev, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	if (waiterRetain(pt,fn,param_len) != 0)
+		return -1;
+
+	struct Waiter* head = atomic_load_explicit(&ev->m_waiters,memory_order_acquire);
+	if (head == EVENT_SIGNALLED)
+	{
+		runNow(pt,fn,param,param_len);
+		return 0;
+	}
+
+	struct Waiter* w = waiterCreate(pt,fn,param,param_len);
+	do
+	{
+		if (head == EVENT_SIGNALLED)
+		{
+			// Signalled while we were getting ready
+			waiterRun(w);
+			return 0;
+		}
+
+		atomic_store_explicit(&w->m_node.m_next,(struct MpscNode*)head,memory_order_relaxed);
+	}
+	while (!atomic_compare_exchange_weak_explicit(&ev->m_waiters,&head,w,memory_order_release,memory_order_acquire));
+
+	return 0;
+}
+
+static void eventSet(struct Event* ev)
+{
+	struct Waiter* head = atomic_exchange_explicit(&ev->m_waiters,EVENT_SIGNALLED,memory_order_acq_rel);
+	if (head == EVENT_SIGNALLED)
+		return;
+
+	// Reverse the LIFO, so waiters run in the order they arrived
+	struct Waiter* fifo = NULL;
+	while (head)
+	{
+		struct Waiter* next = (struct Waiter*)atomic_load_explicit(&head->m_node.m_next,memory_order_relaxed);
+		atomic_store_explicit(&head->m_node.m_next,(struct MpscNode*)fifo,memory_order_relaxed);
+		fifo = head;
+		head = next;
+	}
+
+	while (fifo)
+	{
+		struct Waiter* next = (struct Waiter*)atomic_load_explicit(&fifo->m_node.m_next,memory_order_relaxed);
+		waiterRun(fifo);
+		fifo = next;
+	}
+}
+
+static void eventDiscard(struct Event* ev)
+{
+	struct Waiter* head = atomic_exchange(&ev->m_waiters,NULL);
+	while (head && head != EVENT_SIGNALLED)
+	{
+		struct Waiter* next = (struct Waiter*)atomic_load_explicit(&head->m_node.m_next,memory_order_relaxed);
+		waiterDiscard(head);
+		head = next;
+	}
+}
+
+task_event_t task_event_create(int signalled)
+{
+	struct Event* ev = malloc(sizeof(struct Event));
+	if (!ev)
+		abort();
+
+	eventInit(ev,signalled);
+	return (task_event_t)ev;
+}
+
+void task_event_destroy(task_event_t ev)
+{
+	if (ev)
+	{
+		eventDiscard((struct Event*)ev);
+		free(ev);
+	}
+}
+
+int task_event_wait(task_event_t ev, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	return eventWait((struct Event*)ev,pt,fn,param,param_len);
+}
+
+void task_event_set(task_event_t ev)
+{
+	eventSet((struct Event*)ev);
+}
+
+void task_event_reset(task_event_t ev)
+{
+	struct Waiter* head = EVENT_SIGNALLED;
+	atomic_compare_exchange_strong(&((struct Event*)ev)->m_waiters,&head,NULL);
+}
+
+task_latch_t task_latch_create(unsigned int count)
+{
+	struct Latch* l = malloc(sizeof(struct Latch));
+	if (!l)
+		abort();
+
+	atomic_init(&l->m_count,count);
+	eventInit(&l->m_event,count == 0);
+	return (task_latch_t)l;
+}
+
+void task_latch_destroy(task_latch_t l)
+{
+	if (l)
+	{
+		eventDiscard(&((struct Latch*)l)->m_event);
+		free(l);
+	}
+}
+
+int task_latch_wait(task_latch_t l, task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	return eventWait(&((struct Latch*)l)->m_event,pt,fn,param,param_len);
+}
+
+void task_latch_count_down(task_latch_t lh, unsigned int n)
+{
+	struct Latch* l = (struct Latch*)lh;
+
+	unsigned int c = atomic_fetch_sub_explicit(&l->m_count,n,memory_order_acq_rel);
+	assert(c >= n);
+	if (c == n)
+		eventSet(&l->m_event);
+}
@@ -0,0 +1,57 @@
+
+#ifndef SRC_SYNC_H_
+#define SRC_SYNC_H_
+
+#include "task.h"
+
+// None of these block a worker: a contended wait parks fn as a continuation,
+// which is run as a task (a child of pt) on the releasing thread once it succeeds
+
+typedef struct opaque_task_mutex_t
+{
+	int _unused;
+}* task_mutex_t;
+
+task_mutex_t task_mutex_create(void);
+void task_mutex_destroy(task_mutex_t m);
+
+int task_mutex_trylock(task_mutex_t m);
+int task_mutex_lock(task_mutex_t m, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+void task_mutex_unlock(task_mutex_t m);
+
+typedef struct opaque_task_sem_t
+{
+	int _unused;
+}* task_sem_t;
+
+task_sem_t task_sem_create(unsigned int count);
+void task_sem_destroy(task_sem_t s);
+
+int task_sem_trywait(task_sem_t s);
+int task_sem_wait(task_sem_t s, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+void task_sem_post(task_sem_t s);
+
+typedef struct opaque_task_event_t
+{
+	int _unused;
+}* task_event_t;
+
+task_event_t task_event_create(int signalled);
+void task_event_destroy(task_event_t ev);
+
+int task_event_wait(task_event_t ev, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+void task_event_set(task_event_t ev);
+void task_event_reset(task_event_t ev);
+
+typedef struct opaque_task_latch_t
+{
+	int _unused;
+}* task_latch_t;
+
+task_latch_t task_latch_create(unsigned int count);
+void task_latch_destroy(task_latch_t l);
+
+int task_latch_wait(task_latch_t l, task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+void task_latch_count_down(task_latch_t l, unsigned int n);
+
+#endif /* SRC_SYNC_H_ */
@@ -6,6 +6,7 @@
 #include <stdatomic.h>
 #include <assert.h>
 #include <string.h>
+#include <errno.h>
 
 #if defined(__MINGW32__)
 static inline void* aligned_alloc(size_t alignment, size_t size)
@@ -83,6 +84,9 @@ struct ThreadInfo
 	struct Task** m_deque;
 };
 
+// How many tasks a worker runs before it checks for events anyway
+#define POLL_INTERVAL 64
+
 struct Scheduler
 {
 	unsigned int m_threads;
@@ -90,6 +94,15 @@ struct Scheduler
 	atomic_int   m_status;
 	sema_t       m_sema;
 
+	// The idle poll, only one worker at a time holds m_polling and may call m_poll_fn
+	atomic_int   m_polling;
+	atomic_int   m_poll_changing;
+	atomic_int   m_poll_blocked;
+	atomic_int   m_wakers;
+	_Atomic(scheduler_poll_fn_t) m_poll_fn;
+	scheduler_wake_fn_t m_wake_fn;
+	void*        m_poll_param;
+
 	struct ThreadInfo m_thread_info[];
 };
 
@@ -112,6 +125,23 @@ static void schedulerSignal(struct Scheduler* s)
 		if (sema_signal(&s->m_sema,1) != thrd_success)
 			abort();
 	}
+
+	// A worker blocked polling for events isn't waiting on the semaphore, though without a poll there is nothing to wake
+	if (!atomic_load_explicit(&s->m_poll_fn,memory_order_relaxed))
+		return;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&s->m_poll_blocked,memory_order_relaxed))
+	{
+		atomic_fetch_add_explicit(&s->m_wakers,1,memory_order_acquire);
+		if (atomic_exchange_explicit(&s->m_poll_blocked,0,memory_order_acq_rel))
+		{
+			scheduler_wake_fn_t wake_fn = s->m_wake_fn;
+			if (wake_fn)
+				(*wake_fn)(s->m_poll_param);
+		}
+		atomic_fetch_sub_explicit(&s->m_wakers,1,memory_order_release);
+	}
 }
 
 static void schedulerWait(struct Scheduler* s)
@@ -223,17 +253,18 @@ static int taskRunNext(struct ThreadInfo* info)
 	struct Task* task = taskPop(info);
 	if (!task)
 	{
-		// Pick a random other thread
-		struct ThreadInfo* other_info = info;
-		while (other_info == info)
+		// Try every other thread, starting from a random one, so a thread that
+		// never returns to its own loop (e.g. the proactor) can't strand its tasks
+		// This doesn't need to be better than xorshift
+		info->m_rng = xorshift(info->m_rng);
+
+		unsigned int threads = info->m_scheduler->m_threads;
+		for (unsigned int i = 0; !task && i < threads; ++i)
 		{
-			// This doesn't need to be better than xorshift
-			info->m_rng = xorshift(info->m_rng);
-			
-			other_info = &info->m_scheduler->m_thread_info[info->m_rng % info->m_scheduler->m_threads];
+			struct ThreadInfo* other_info = &info->m_scheduler->m_thread_info[(info->m_rng + i) % threads];
+			if (other_info != info)
+				task = taskSteal(other_info);
 		}
-		
-		task = taskSteal(other_info);
 	}
 	
 	if (task)
@@ -245,6 +276,50 @@ static int taskRunNext(struct ThreadInfo* info)
 	return 0;
 }
 
+static int schedulerHasWork(struct Scheduler* s)
+{
+	for (unsigned int i = 0; i < s->m_threads; ++i)
+	{
+		struct ThreadInfo* info = &s->m_thread_info[i];
+		if (atomic_load_explicit(&info->m_bottom,memory_order_relaxed) - atomic_load_explicit(&info->m_top,memory_order_relaxed) > 0)
+			return 1;
+	}
+	return 0;
+}
+
+// Returns 0 if there is no idle poll, or another worker is already in it
+static int schedulerPoll(struct Scheduler* s, int block)
+{
+	// Cheap checks first, so a scheduler without a poll doesn't contend on m_polling
+	if (!atomic_load_explicit(&s->m_poll_fn,memory_order_relaxed) || atomic_load_explicit(&s->m_poll_changing,memory_order_relaxed) || atomic_load_explicit(&s->m_polling,memory_order_relaxed))
+		return 0;
+
+	int expected = 0;
+	if (!atomic_compare_exchange_strong_explicit(&s->m_polling,&expected,1,memory_order_acquire,memory_order_relaxed))
+		return 0;
+
+	int polled = 0;
+	scheduler_poll_fn_t poll_fn = atomic_load_explicit(&s->m_poll_fn,memory_order_relaxed);
+	if (poll_fn)
+	{
+		if (block)
+		{
+			// Publish that we are about to block, then check nothing was queued meanwhile
+			atomic_store_explicit(&s->m_poll_blocked,1,memory_order_relaxed);
+			atomic_thread_fence(memory_order_seq_cst);
+			if (schedulerHasWork(s))
+				block = 0;
+		}
+
+		(*poll_fn)(s->m_poll_param,block);
+		atomic_store_explicit(&s->m_poll_blocked,0,memory_order_relaxed);
+		polled = 1;
+	}
+
+	atomic_store_explicit(&s->m_polling,0,memory_order_release);
+	return polled;
+}
+
 static struct Task* taskAllocate(struct ThreadInfo* info)
 {
 	struct Task* task = NULL;
@@ -261,16 +336,17 @@ static struct Task* taskAllocate(struct ThreadInfo* info)
 	for (unsigned int i = 0; i < TASK_COUNT; ++i)
 	{
 		p.parts.offset = (info->m_free_task++) % TASK_COUNT;
-		task = &info->m_pool[p.parts.offset];
-		if (atomic_load_explicit(&task->m_active,memory_order_relaxed) == 0)
+		struct Task* t = &info->m_pool[p.parts.offset];
+		if (atomic_load_explicit(&t->m_active,memory_order_acquire) == 0)
 		{
-			atomic_store_explicit(&task->m_active,1,memory_order_relaxed);
+			atomic_store_explicit(&t->m_active,1,memory_order_relaxed);
 			
-			p.parts.generation = ++task->m_generation;
+			p.parts.generation = ++t->m_generation;
 			if (!p.parts.generation)
-				p.parts.generation = ++task->m_generation;
+				p.parts.generation = ++t->m_generation;
 			
-			task->m_handle = p.task;
+			t->m_handle = p.task;
+			task = t;
 			break;
 		}
 	}
@@ -306,12 +382,36 @@ void task_join(task_t handle)
 		taskRunNext(info);
 }
 
+int task_retain(task_t handle)
+{
+	if (!handle)
+		return 0;
+
+	struct Task* task = taskDeref(get_thread_info(),handle);
+	if (!task)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Hold the task open as if it had another child
+	atomic_fetch_add_explicit(&task->m_active,1,memory_order_relaxed);
+	return 0;
+}
+
+void task_release(task_t handle)
+{
+	struct Task* task = handle ? taskDeref(get_thread_info(),handle) : NULL;
+	if (task)
+		taskFinish(task);
+}
+
 int task_work()
 {
 	return taskRunNext(get_thread_info());
 }
 
-task_t task_run(task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+static task_t taskRun(task_t pt, task_fn_t fn, const void* param, unsigned int param_len, int wait)
 {
 	if (!fn || param_len > TASK_PARAM_MAX)
 	{
@@ -330,6 +430,12 @@ task_t task_run(task_t pt, task_fn_t fn, const void* param, unsigned int param_l
 	struct Task* task = NULL;
 	while (!(task = taskAllocate(info)))
 	{
+		if (!wait)
+		{
+			errno = EAGAIN;
+			return NULL;
+		}
+
 		// Out of pool space for this thread
 		taskRunNext(info);
 	}
@@ -341,6 +447,7 @@ task_t task_run(task_t pt, task_fn_t fn, const void* param, unsigned int param_l
 	if (task->m_parent)
 		atomic_fetch_add_explicit(&parent->m_active,1,memory_order_relaxed);
 	
+	// Every task in the deque came from this thread's pool, so having allocated one there is room without waiting
 	while (!taskPush(info,task))
 	{
 		// Out of deque space for this thread
@@ -352,21 +459,110 @@ task_t task_run(task_t pt, task_fn_t fn, const void* param, unsigned int param_l
 	return task->m_handle;
 }
 
+task_t task_run(task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	return taskRun(pt,fn,param,param_len,1);
+}
+
+task_t task_try_run(task_t pt, task_fn_t fn, const void* param, unsigned int param_len)
+{
+	return taskRun(pt,fn,param,param_len,0);
+}
+
+size_t task_queue_depth()
+{
+	struct ThreadInfo* info = get_thread_info();
+	if (!info)
+		return 0;
+
+	size_t depth = 0;
+	for (unsigned int i = 0; i < info->m_scheduler->m_threads; ++i)
+	{
+		struct ThreadInfo* other_info = &info->m_scheduler->m_thread_info[i];
+		int n = atomic_load_explicit(&other_info->m_bottom,memory_order_relaxed) - atomic_load_explicit(&other_info->m_top,memory_order_relaxed);
+		if (n > 0)
+			depth += n;
+	}
+	return depth;
+}
+
+unsigned int task_worker_count()
+{
+	struct ThreadInfo* info = get_thread_info();
+	return info ? info->m_scheduler->m_threads : 0;
+}
+
 static int schedulerThread(void* p)
 {
 	struct ThreadInfo* info = p;
 	
 	tss_set(s_thread_info,info);
 
+	unsigned int ran = 0;
 	while (!info->m_close)
 	{
-		if (!taskRunNext(info))
+		if (taskRunNext(info))
+		{
+			// Don't let a busy scheduler starve the events
+			if (++ran % POLL_INTERVAL == 0)
+				schedulerPoll(info->m_scheduler,0);
+		}
+		else if (!schedulerPoll(info->m_scheduler,1))
 			schedulerWait(info->m_scheduler);
 	}
 		
 	return 0;
 }
 
+int scheduler_set_idle_poll(scheduler_t sc, scheduler_poll_fn_t poll_fn, scheduler_wake_fn_t wake_fn, void* param)
+{
+	struct Scheduler* s = (struct Scheduler*)sc;
+	if (!s || (poll_fn && !wake_fn))
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Take the poll away from whichever worker has it, and stop it being taken again
+	atomic_fetch_add_explicit(&s->m_poll_changing,1,memory_order_relaxed);
+	for (;;)
+	{
+		int expected = 0;
+		if (atomic_compare_exchange_weak_explicit(&s->m_polling,&expected,1,memory_order_acquire,memory_order_relaxed))
+			break;
+
+		if (atomic_exchange_explicit(&s->m_poll_blocked,0,memory_order_acq_rel))
+			(*s->m_wake_fn)(s->m_poll_param);
+
+		thrd_yield();
+	}
+
+	if (atomic_load_explicit(&s->m_poll_fn,memory_order_relaxed) && poll_fn && s->m_poll_param != param)
+	{
+		atomic_store_explicit(&s->m_polling,0,memory_order_release);
+		atomic_fetch_sub_explicit(&s->m_poll_changing,1,memory_order_relaxed);
+		errno = EBUSY;
+		return -1;
+	}
+
+	atomic_store_explicit(&s->m_poll_fn,poll_fn,memory_order_relaxed);
+	s->m_wake_fn = wake_fn;
+	s->m_poll_param = param;
+
+	// Anyone already waking the old poll may still be using it
+	while (atomic_load_explicit(&s->m_wakers,memory_order_acquire))
+		thrd_yield();
+
+	atomic_store_explicit(&s->m_polling,0,memory_order_release);
+	atomic_fetch_sub_explicit(&s->m_poll_changing,1,memory_order_relaxed);
+
+	// Get an idle worker polling
+	if (poll_fn)
+		schedulerSignal(s);
+
+	return 0;
+}
+
 void scheduler_destroy(scheduler_t sc)
 {
 	struct Scheduler* s = (struct Scheduler*)sc;
@@ -419,6 +615,13 @@ scheduler_t scheduler_create(unsigned int threads)
 		abort();
 
 	atomic_store(&s->m_status,0);
+	atomic_init(&s->m_polling,0);
+	atomic_init(&s->m_poll_changing,0);
+	atomic_init(&s->m_poll_blocked,0);
+	atomic_init(&s->m_wakers,0);
+	atomic_init(&s->m_poll_fn,NULL);
+	s->m_wake_fn = NULL;
+	s->m_poll_param = NULL;
 
 	if (sema_init(&s->m_sema,0) != thrd_success)
 		abort();
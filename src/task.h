@@ -10,10 +10,23 @@ typedef void (*task_fn_t)(task_t task, void* param);
 #define TASK_PARAM_MAX (32 + 64)
 
 task_t task_run(task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+
+// As task_run(), but rather than run other tasks to make room when the calling thread's pool is full, fails with EAGAIN
+task_t task_try_run(task_t pt, task_fn_t fn, const void* param, unsigned int param_len);
+
 void task_join(task_t handle);
 
+int task_retain(task_t handle);
+void task_release(task_t handle);
+
 int task_work();
 
+// Roughly how many tasks are queued on the calling thread's scheduler, waiting for a worker
+size_t task_queue_depth();
+
+// How many workers the calling thread's scheduler has, 0 if the calling thread isn't one of them
+unsigned int task_worker_count();
+
 typedef struct opaque_scheduler_t
 {
 	int _unused;
@@ -22,4 +35,13 @@ typedef struct opaque_scheduler_t
 scheduler_t scheduler_create(unsigned int threads);
 void scheduler_destroy(scheduler_t sc);
 
+// An event source that idle workers poll in place of sleeping, one worker at a time
+// poll_fn(param,block) runs whatever is ready, and if block is set waits for something first
+// wake_fn(param) is called from any thread, and must make a blocked poll_fn return
+// Pass NULL to remove it, which returns once no worker is polling any more
+typedef void (*scheduler_poll_fn_t)(void* param, int block);
+typedef void (*scheduler_wake_fn_t)(void* param);
+
+int scheduler_set_idle_poll(scheduler_t sc, scheduler_poll_fn_t poll_fn, scheduler_wake_fn_t wake_fn, void* param);
+
 #endif /* SRC_TASK_H_ */
@@ -89,6 +89,7 @@ static inline void sema_destroy(sema_t* s)
 
 #else
 #include <pthread.h>
+#include <sched.h>
 #include <errno.h>
 #include <stdint.h>
 
@@ -117,7 +118,7 @@ typedef pthread_t thrd_t;
 
 typedef int(*thrd_start_t)(void*);
 
-#define thrd_yield pthread_yield
+#define thrd_yield sched_yield
 #define thrd_equal pthread_equal
 #define thrd_current pthread_self
 
@@ -0,0 +1,207 @@
+
+#ifndef SRC_URING_H_
+#define SRC_URING_H_
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+// A minimal io_uring, straight onto the syscalls so there is no dependency on liburing
+//
+// Single threaded: only the proactor touches it.  SQEs are queued with uringGetSqe() and
+// handed to the kernel in one go by uringSubmit(), completions are read with uringPeek()
+
+struct Uring
+{
+	int                  m_fd;
+	unsigned int         m_features;
+
+	atomic_uint*         m_sq_head;
+	atomic_uint*         m_sq_tail;
+	atomic_uint*         m_sq_flags;
+	unsigned int         m_sq_mask;
+	unsigned int         m_sq_entries;
+	unsigned int         m_sq_local_tail;
+	unsigned int         m_sq_submitted;
+	struct io_uring_sqe* m_sqes;
+
+	atomic_uint*         m_cq_head;
+	atomic_uint*         m_cq_tail;
+	unsigned int         m_cq_mask;
+	struct io_uring_cqe* m_cqes;
+
+	void*                m_sq_ring;
+	size_t               m_sq_ring_size;
+	void*                m_cq_ring;
+	size_t               m_cq_ring_size;
+	size_t               m_sqes_size;
+};
+
+static inline void uringDestroy(struct Uring* u)
+{
+	if (u->m_sqes)
+		munmap(u->m_sqes,u->m_sqes_size);
+	if (u->m_cq_ring && u->m_cq_ring != u->m_sq_ring)
+		munmap(u->m_cq_ring,u->m_cq_ring_size);
+	if (u->m_sq_ring)
+		munmap(u->m_sq_ring,u->m_sq_ring_size);
+	if (u->m_fd != -1)
+		close(u->m_fd);
+
+	u->m_fd = -1;
+}
+
+// Returns -1 if the kernel won't give us a ring (too old, or blocked by policy)
+static inline int uringInit(struct Uring* u, unsigned int entries)
+{
+	memset(u,0,sizeof(struct Uring));
+
+	struct io_uring_params p;
+	memset(&p,0,sizeof(p));
+#if defined(IORING_SETUP_CLAMP)
+	p.flags = IORING_SETUP_CLAMP;
+#endif
+
+	u->m_fd = syscall(__NR_io_uring_setup,entries,&p);
+	if (u->m_fd == -1)
+		return -1;
+
+	u->m_features = p.features;
+
+	u->m_sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	u->m_cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (u->m_cq_ring_size > u->m_sq_ring_size)
+			u->m_sq_ring_size = u->m_cq_ring_size;
+		u->m_cq_ring_size = u->m_sq_ring_size;
+	}
+
+	u->m_sq_ring = mmap(NULL,u->m_sq_ring_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,u->m_fd,IORING_OFF_SQ_RING);
+	if (u->m_sq_ring == MAP_FAILED)
+	{
+		u->m_sq_ring = NULL;
+		uringDestroy(u);
+		return -1;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		u->m_cq_ring = u->m_sq_ring;
+	else
+	{
+		u->m_cq_ring = mmap(NULL,u->m_cq_ring_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,u->m_fd,IORING_OFF_CQ_RING);
+		if (u->m_cq_ring == MAP_FAILED)
+		{
+			u->m_cq_ring = NULL;
+			uringDestroy(u);
+			return -1;
+		}
+	}
+
+	u->m_sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->m_sqes = mmap(NULL,u->m_sqes_size,PROT_READ | PROT_WRITE,MAP_SHARED | MAP_POPULATE,u->m_fd,IORING_OFF_SQES);
+	if (u->m_sqes == MAP_FAILED)
+	{
+		u->m_sqes = NULL;
+		uringDestroy(u);
+		return -1;
+	}
+
+	unsigned char* sq = u->m_sq_ring;
+	u->m_sq_head = (atomic_uint*)(sq + p.sq_off.head);
+	u->m_sq_tail = (atomic_uint*)(sq + p.sq_off.tail);
+	u->m_sq_flags = (atomic_uint*)(sq + p.sq_off.flags);
+	u->m_sq_mask = *(unsigned int*)(sq + p.sq_off.ring_mask);
+	u->m_sq_entries = p.sq_entries;
+	u->m_sq_local_tail = u->m_sq_submitted = atomic_load_explicit(u->m_sq_tail,memory_order_relaxed);
+
+	// SQEs are always used in order, so the indirection array is fixed
+	unsigned int* array = (unsigned int*)(sq + p.sq_off.array);
+	for (unsigned int i = 0; i < p.sq_entries; ++i)
+		array[i] = i;
+
+	unsigned char* cq = u->m_cq_ring;
+	u->m_cq_head = (atomic_uint*)(cq + p.cq_off.head);
+	u->m_cq_tail = (atomic_uint*)(cq + p.cq_off.tail);
+	u->m_cq_mask = *(unsigned int*)(cq + p.cq_off.ring_mask);
+	u->m_cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+	return 0;
+}
+
+// Returns NULL if the submission queue is full, call uringSubmit() and try again
+static inline struct io_uring_sqe* uringGetSqe(struct Uring* u)
+{
+	unsigned int head = atomic_load_explicit(u->m_sq_head,memory_order_acquire);
+	if (u->m_sq_local_tail - head >= u->m_sq_entries)
+		return NULL;
+
+	struct io_uring_sqe* sqe = &u->m_sqes[u->m_sq_local_tail++ & u->m_sq_mask];
+	memset(sqe,0,sizeof(struct io_uring_sqe));
+	return sqe;
+}
+
+// One syscall for everything queued since the last call
+static inline void uringSubmit(struct Uring* u)
+{
+	unsigned int to_submit = u->m_sq_local_tail - u->m_sq_submitted;
+	if (!to_submit)
+		return;
+
+	atomic_store_explicit(u->m_sq_tail,u->m_sq_local_tail,memory_order_release);
+
+	while (to_submit)
+	{
+		int ret = syscall(__NR_io_uring_enter,u->m_fd,to_submit,0,0,NULL,0);
+		if (ret == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			// Out of memory for requests, completions need reaping first
+			if (errno == EAGAIN || errno == EBUSY)
+				break;
+
+			abort();
+		}
+		to_submit -= ret;
+		u->m_sq_submitted += ret;
+	}
+}
+
+static inline struct io_uring_cqe* uringPeek(struct Uring* u)
+{
+	unsigned int head = atomic_load_explicit(u->m_cq_head,memory_order_relaxed);
+	if (head == atomic_load_explicit(u->m_cq_tail,memory_order_acquire))
+		return NULL;
+
+	return &u->m_cqes[head & u->m_cq_mask];
+}
+
+static inline void uringAdvance(struct Uring* u)
+{
+	atomic_store_explicit(u->m_cq_head,atomic_load_explicit(u->m_cq_head,memory_order_relaxed) + 1,memory_order_release);
+}
+
+// Completions the CQ ring had no room for wait in the kernel until asked for, and the ring fd isn't readable for them
+// Returns non-zero if there were any, and some may now be in the ring
+static inline int uringFlushOverflow(struct Uring* u)
+{
+#if defined(IORING_SQ_CQ_OVERFLOW)
+	if (!(atomic_load_explicit(u->m_sq_flags,memory_order_acquire) & IORING_SQ_CQ_OVERFLOW))
+		return 0;
+
+	while (syscall(__NR_io_uring_enter,u->m_fd,0,0,IORING_ENTER_GETEVENTS,NULL,0) == -1 && errno == EINTR)
+		;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+#endif /* SRC_URING_H_ */
@@ -0,0 +1,48 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../src/proactor_group.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// proactor_group_listen() must open a listener per shard where the platform can share a port
+// Exits 77, which automake takes as a skip, elsewhere
+
+int main()
+{
+#if !defined(__linux__)
+	return 77;
+#else
+	scheduler_t sc = scheduler_create(4);
+	proactor_group_t pg = proactor_group_create(NULL,3);
+	if (!pg)
+	{
+		perror("proactor_group_create");
+		return 1;
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr,0,sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	socket_t fds[3];
+	int count = proactor_group_listen(pg,(const struct sockaddr*)&addr,sizeof(addr),16,fds);
+	int ret = 0;
+	if (count != (int)proactor_group_size(pg))
+	{
+		fprintf(stderr,"proactor_group_listen() opened %d listeners for %u shards\n",count,proactor_group_size(pg));
+		ret = 1;
+	}
+
+	for (int i = 0; i < count; ++i)
+		close(fds[i]);
+
+	proactor_group_destroy(pg);
+	scheduler_destroy(sc);
+	return ret;
+#endif
+}